@@ -0,0 +1,338 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+// Generates almost-sorted test data for lsort. Each line starts with a 20 digit key,
+// the disorder model decides in which order the keys are written.
+
+#include <ctype.h>
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define KEY_SIZE 20
+#define SPACING 1024
+#define BASE 1000000000000000ULL
+#define POOL 65536
+#define SHARDS 8
+
+char* prg;
+
+enum model
+{
+   MODEL_SORTED,
+   MODEL_JITTER,
+   MODEL_LATE,
+   MODEL_BURST,
+   MODEL_SHARDS,
+   MODEL_REVERSE
+};
+
+const char* model_names[] = { "sorted", "jitter", "late", "burst", "shards", "reverse", NULL };
+
+enum distribution
+{
+   DISTRIBUTION_FIXED,
+   DISTRIBUTION_UNIFORM,
+   DISTRIBUTION_EXP
+};
+
+size_t size = (size_t)64 << 20;
+int model = MODEL_JITTER;
+size_t width = 100;
+double probability = 0.001;
+int distribution = DISTRIBUTION_UNIFORM;
+size_t min_length = 20;
+size_t max_length = 200;
+uint64_t state = 42;
+
+void print_help()
+{
+   fprintf( stdout, "Usage: %s [OPTION]...\n"
+                    "Generate almost-sorted lines for benchmarking lsort\n"
+                    "\n"
+                    "Options:\n"
+                    "  -s, --size N               generate N bytes, default: 64M\n"
+                    "  -m, --model NAME           disorder model, default: jitter\n"
+                    "  -w, --width N              disorder width in lines, default: 100\n"
+                    "  -p, --probability P        probability of a late line or burst, default: 0.001\n"
+                    "  -l, --length DIST          line length distribution, default: uniform:20-200\n"
+                    "      --seed N               random seed, default: 42\n"
+                    "      --help                 display this help and exit\n"
+                    "\n"
+                    "Models:\n"
+                    "  sorted      no disorder\n"
+                    "  jitter      every line is shifted by up to --width lines in either direction\n"
+                    "  late        lines arrive up to --width lines late with --probability\n"
+                    "  burst       bursts of up to --width lines arrive --width to 2*--width lines\n"
+                    "              late, a burst starts with --probability\n"
+                    "  shards      8 sorted shards are interleaved with a clock skew of up to --width lines\n"
+                    "  reverse     blocks of --width lines are reversed\n"
+                    "\n"
+                    "Line length distributions (including the key and the newline):\n"
+                    "  fixed:N, uniform:MIN-MAX, exp:MEAN\n"
+                    "\n"
+                    "N may be followed by the following multiplicative suffixes:\n"
+                    "B=1, K=1024, and so on for M, G, T, P, E.\n",
+            prg );
+}
+
+// splitmix64
+uint64_t next_random()
+{
+   uint64_t z = ( state += 0x9e3779b97f4a7c15ULL );
+   z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+   z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+   return z ^ ( z >> 31 );
+}
+
+// uniform in [0, n)
+uint64_t uniform( uint64_t n )
+{
+   return ( n == 0 ) ? 0 : ( next_random() % n );
+}
+
+// uniform in [0, 1)
+double real()
+{
+   return ( next_random() >> 11 ) * ( 1.0 / 9007199254740992.0 );
+}
+
+void invalid( const char* p )
+{
+   fprintf( stderr, "%s: Invalid argument '%s'\n", prg, p );
+   exit( EXIT_FAILURE );
+}
+
+size_t parse( const char* p )
+{
+   if( !isdigit( *p ) ) {
+      invalid( p );
+   }
+   char* endptr;
+   errno = 0;
+   const size_t n = strtoul( p, &endptr, 10 );
+   if( errno != 0 ) {
+      invalid( p );
+   }
+   size_t f = 1;
+   switch( *endptr ) {
+      case 'E':
+         f *= 1024;
+         // fall-through
+      case 'P':
+         f *= 1024;
+         // fall-through
+      case 'T':
+         f *= 1024;
+         // fall-through
+      case 'G':
+         f *= 1024;
+         // fall-through
+      case 'M':
+         f *= 1024;
+         // fall-through
+      case 'K':
+         f *= 1024;
+         // fall-through
+      case 'B':
+         ++endptr;
+         break;
+   }
+   if( *endptr != '\0' ) {
+      invalid( p );
+   }
+   return n * f;
+}
+
+void parse_length( char* p )
+{
+   char* arg = strchr( p, ':' );
+   if( arg == NULL ) {
+      invalid( p );
+   }
+   *arg++ = '\0';
+   if( strcmp( p, "fixed" ) == 0 ) {
+      distribution = DISTRIBUTION_FIXED;
+      min_length = max_length = parse( arg );
+   }
+   else if( strcmp( p, "uniform" ) == 0 ) {
+      char* max = strchr( arg, '-' );
+      if( max == NULL ) {
+         invalid( arg );
+      }
+      *max++ = '\0';
+      distribution = DISTRIBUTION_UNIFORM;
+      min_length = parse( arg );
+      max_length = parse( max );
+   }
+   else if( strcmp( p, "exp" ) == 0 ) {
+      distribution = DISTRIBUTION_EXP;
+      min_length = max_length = parse( arg );
+   }
+   else {
+      invalid( p );
+   }
+   if( min_length > max_length ) {
+      invalid( arg );
+   }
+}
+
+size_t line_length()
+{
+   size_t result = min_length;
+   switch( distribution ) {
+      case DISTRIBUTION_UNIFORM:
+         result += uniform( max_length - min_length + 1 );
+         break;
+      case DISTRIBUTION_EXP: {
+         const double r = real();
+         result = ( r > 0 ) ? ( -1.0 * min_length * log1p( -r ) ) : 0;
+         break;
+      }
+   }
+   return ( result < KEY_SIZE + 2 ) ? ( KEY_SIZE + 2 ) : result;
+}
+
+// the position i is written with the key of the position returned
+uint64_t key( uint64_t i )
+{
+   static int64_t burst_end = -1;
+   static uint64_t burst_delay = 0;
+   static int64_t skew[ SHARDS ];
+   static int initialized = 0;
+
+   int64_t k = (int64_t)i * SPACING;
+   switch( model ) {
+      case MODEL_JITTER:
+         k += (int64_t)uniform( 2 * width * SPACING + 1 ) - (int64_t)( width * SPACING );
+         break;
+      case MODEL_LATE:
+         if( real() < probability ) {
+            k -= ( 1 + uniform( width ) ) * SPACING + SPACING / 2;
+         }
+         break;
+      case MODEL_BURST:
+         if( ( (int64_t)i > burst_end ) && ( real() < probability ) ) {
+            burst_end = i + uniform( width );
+            burst_delay = width + uniform( width + 1 );
+         }
+         if( (int64_t)i <= burst_end ) {
+            k -= burst_delay * SPACING + SPACING / 2;
+         }
+         break;
+      case MODEL_SHARDS:
+         if( !initialized ) {
+            for( int s = 0; s != SHARDS; ++s ) {
+               skew[ s ] = uniform( width + 1 ) * SPACING;
+            }
+            initialized = 1;
+         }
+         k += skew[ i % SHARDS ] + i % SHARDS;
+         break;
+      case MODEL_REVERSE:
+         if( width != 0 ) {
+            k = (int64_t)( i / width * width + ( width - 1 - i % width ) ) * SPACING;
+         }
+         break;
+   }
+   return BASE + k;
+}
+
+int main( int argc, char** argv )
+{
+   prg = argv[ 0 ];
+
+   static struct option long_options[] = {
+      { "size", required_argument, NULL, 's' },
+      { "model", required_argument, NULL, 'm' },
+      { "width", required_argument, NULL, 'w' },
+      { "probability", required_argument, NULL, 'p' },
+      { "length", required_argument, NULL, 'l' },
+      { "seed", required_argument, NULL, 0 },
+      { "help", no_argument, NULL, 0 },
+      { NULL, 0, NULL, 0 }
+   };
+
+   int opt = 0;
+   int long_index = 0;
+   while( ( opt = getopt_long( argc, argv, "s:m:w:p:l:", long_options, &long_index ) ) != -1 ) {
+      switch( opt ) {
+         case 's':
+            size = parse( optarg );
+            break;
+         case 'm': {
+            int i = 0;
+            while( ( model_names[ i ] != NULL ) && ( strcmp( model_names[ i ], optarg ) != 0 ) ) {
+               ++i;
+            }
+            if( model_names[ i ] == NULL ) {
+               invalid( optarg );
+            }
+            model = i;
+            break;
+         }
+         case 'w':
+            width = parse( optarg );
+            break;
+         case 'p':
+            probability = atof( optarg );
+            break;
+         case 'l':
+            parse_length( optarg );
+            break;
+         case 0: {
+            const char* name = long_options[ long_index ].name;
+            if( strcmp( name, "seed" ) == 0 ) {
+               state = parse( optarg );
+               break;
+            }
+            if( strcmp( name, "help" ) == 0 ) {
+               print_help();
+               return EXIT_SUCCESS;
+            }
+            exit( EXIT_FAILURE );
+         }
+         default:
+            fprintf( stderr, "Try '%s --help' for more information.\n", prg );
+            exit( EXIT_FAILURE );
+      }
+   }
+
+   static char pool[ POOL ];
+   for( size_t i = 0; i != POOL; ++i ) {
+      pool[ i ] = 'a' + uniform( 26 );
+   }
+
+   static char line[ KEY_SIZE + 2 ];
+   size_t written = 0;
+   for( uint64_t i = 0; written < size; ++i ) {
+      size_t length = line_length();
+      const size_t remaining = size - written;
+      if( ( length > remaining ) || ( remaining - length < KEY_SIZE + 2 ) ) {
+         length = ( remaining > KEY_SIZE + 2 ) ? remaining : ( KEY_SIZE + 2 );
+      }
+      snprintf( line, sizeof( line ), "%020llu ", (unsigned long long)key( i ) );
+      fwrite( line, 1, KEY_SIZE + 1, stdout );
+      for( size_t payload = length - KEY_SIZE - 2; payload != 0; ) {
+         const size_t n = ( payload < POOL ) ? payload : POOL;
+         fwrite( pool + uniform( POOL - n + 1 ), 1, n, stdout );
+         payload -= n;
+      }
+      if( putchar( '\n' ) == EOF ) {
+         perror( prg );
+         return EXIT_FAILURE;
+      }
+      written += length;
+   }
+   if( fflush( stdout ) != 0 ) {
+      perror( prg );
+      return EXIT_FAILURE;
+   }
+   return EXIT_SUCCESS;
+}
@@ -0,0 +1,246 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+// Times the primitives that dominate lsort's runtime in isolation: le() across
+// line lengths and shared-prefix lengths, with and without case folding, find()
+// and rfind() across line lengths, and the memrchr() replacements that rfind()
+// uses without _GNU_SOURCE.
+// liblsort.c is included directly, so the kernels are exactly the ones lsort runs.
+
+#include <getopt.h>
+
+#include "../liblsort.c"
+
+#define BUFFER_SIZE ( (size_t)1 << 20 )
+
+const size_t lengths[] = { 8, 16, 32, 64, 128, 256, 1024, 4096 };
+#define LENGTHS ( sizeof( lengths ) / sizeof( lengths[ 0 ] ) )
+
+char* prg;
+struct lsort* context;
+struct lsort* fold_context;
+double min_time = 0.1;
+double ghz = 0;
+volatile size_t sink;
+
+void print_micro_help()
+{
+   fprintf( stdout, "Usage: %s [OPTION]...\n"
+                    "Time lsort's le(), find() and rfind() kernels\n"
+                    "\n"
+                    "Options:\n"
+                    "  -t, --time SECONDS         minimum time per measurement, default: 0.1\n"
+                    "      --ghz F                clock frequency used for bytes/cycle,\n"
+                    "                               default: estimated from a dependent add chain\n"
+                    "      --help                 display this help and exit\n",
+            prg );
+}
+
+// one dependent add per iteration runs at one iteration per cycle on current cores
+double estimate_ghz()
+{
+   const size_t n = (size_t)200 << 20;
+   size_t x = 0;
+   const double start = lsort_now();
+   for( size_t i = 0; i != n; ++i ) {
+      __asm__ volatile( "" : "+r"( x ) );
+      ++x;
+   }
+   sink = x;
+   return n / ( lsort_now() - start ) / 1e9;
+}
+
+// fills the buffer with lines of the given length, including the newline
+char* fill( char* data, size_t length )
+{
+   const size_t lines = BUFFER_SIZE / length;
+   char* pos = data;
+   for( size_t i = 0; i != lines; ++i ) {
+      for( size_t j = 0; j != length - 1; ++j ) {
+         *pos++ = 'a' + ( i + j ) % 26;
+      }
+      *pos++ = '\n';
+   }
+   return pos;
+}
+
+size_t run_le( struct lsort* lsort, char* lhs, char* rhs, size_t length, size_t iterations )
+{
+   size_t result = 0;
+   for( size_t i = 0; i != iterations; ++i ) {
+      result += le( lsort, lhs, lhs + length, rhs, rhs + length );
+   }
+   return result;
+}
+
+size_t run_find( char* data, char* end, size_t iterations )
+{
+   size_t result = 0;
+   for( size_t i = 0; i != iterations; ++i ) {
+      for( char* pos = data; pos != end; pos = find( pos, end, '\n' ) ) {
+         ++result;
+      }
+   }
+   return result;
+}
+
+size_t run_rfind( char* data, char* end, size_t iterations )
+{
+   size_t result = 0;
+   for( size_t i = 0; i != iterations; ++i ) {
+      for( char* prev = end; prev != data; prev = rfind( data, prev, '\n' ) ) {
+         ++result;
+      }
+   }
+   return result;
+}
+
+size_t run_reverse( void* ( *search )( const void*, int, size_t ), char* data, char* end, size_t iterations )
+{
+   size_t result = 0;
+   for( size_t i = 0; i != iterations; ++i ) {
+      for( char* prev = end; prev != data; ) {
+         char* pos = (char*)search( data, '\n', prev - data - 1 );
+         prev = ( pos != NULL ) ? ( pos + 1 ) : data;
+         ++result;
+      }
+   }
+   return result;
+}
+
+size_t run_fallback( char* data, char* end, size_t iterations )
+{
+   return run_reverse( fallback_memrchr, data, end, iterations );
+}
+
+size_t run_vector( char* data, char* end, size_t iterations )
+{
+   return run_reverse( vector_memrchr, data, end, iterations );
+}
+
+void report( const char* kernel, size_t length, const char* prefix, double ns, double bytes )
+{
+   fprintf( stdout, "%-18s %8zu %8s %12.2f %12.2f\n", kernel, length, prefix, ns, bytes / ( ns * ghz ) );
+}
+
+// doubles the iteration count until a run takes at least min_time, returns ns per iteration
+#define MEASURE( call, ns )                          \
+   do {                                              \
+      size_t iterations = 1;                         \
+      for( ;; ) {                                    \
+         const size_t n = iterations;                \
+         const double start = lsort_now();           \
+         sink = ( call );                            \
+         const double elapsed = lsort_now() - start; \
+         if( elapsed >= min_time ) {                 \
+            ns = elapsed * 1e9 / n;                  \
+            break;                                   \
+         }                                           \
+         iterations *= 2;                            \
+      }                                              \
+   } while( 0 )
+
+void bench_le()
+{
+   char lhs[ 4096 ];
+   char rhs[ 4096 ];
+   for( size_t i = 0; i != LENGTHS; ++i ) {
+      const size_t length = lengths[ i ];
+      const size_t prefixes[] = { 0, length / 2, length - 2 };
+      for( size_t j = 0; j != 3; ++j ) {
+         const size_t prefix = prefixes[ j ];
+         for( size_t k = 0; k != length - 1; ++k ) {
+            lhs[ k ] = rhs[ k ] = 'a' + k % 26;
+         }
+         lhs[ length - 1 ] = rhs[ length - 1 ] = '\n';
+         rhs[ prefix ] = 'z' + 1;
+         double ns;
+         char buf[ 32 ];
+         snprintf( buf, sizeof( buf ), "%zu", prefix );
+         MEASURE( run_le( context, lhs, rhs, length, iterations ), ns );
+         report( "le", length, buf, ns, prefix + 1 );
+         MEASURE( run_le( fold_context, lhs, rhs, length, iterations ), ns );
+         report( "le -f", length, buf, ns, prefix + 1 );
+      }
+   }
+}
+
+void bench_search( const char* kernel, size_t ( *run )( char*, char*, size_t ), char* data )
+{
+   for( size_t i = 0; i != LENGTHS; ++i ) {
+      const size_t length = lengths[ i ];
+      char* const end = fill( data, length );
+      const size_t lines = ( end - data ) / length;
+      double ns;
+      MEASURE( run( data, end, iterations ), ns );
+      report( kernel, length, "-", ns / lines, length );
+   }
+}
+
+int main( int argc, char** argv )
+{
+   prg = argv[ 0 ];
+
+   static struct option long_options[] = {
+      { "time", required_argument, NULL, 't' },
+      { "ghz", required_argument, NULL, 'g' },
+      { "help", no_argument, NULL, 'h' },
+      { NULL, 0, NULL, 0 }
+   };
+
+   int opt;
+   int long_index = 0;
+   while( ( opt = getopt_long( argc, argv, "t:", long_options, &long_index ) ) != -1 ) {
+      switch( opt ) {
+         case 't':
+            min_time = atof( optarg );
+            break;
+         case 'g':
+            ghz = atof( optarg );
+            break;
+         case 'h':
+            print_micro_help();
+            return EXIT_SUCCESS;
+         default:
+            fprintf( stderr, "Try '%s --help' for more information.\n", prg );
+            return EXIT_FAILURE;
+      }
+   }
+   if( ( min_time <= 0 ) || ( ghz < 0 ) ) {
+      fprintf( stderr, "%s: Invalid argument\n", prg );
+      return EXIT_FAILURE;
+   }
+
+   struct lsort_options options;
+   lsort_default_options( &options );
+   context = lsort_create( &options );
+   options.fold = 1;
+   fold_context = lsort_create( &options );
+   char* const data = (char*)malloc( BUFFER_SIZE );
+   if( ( context == NULL ) || ( fold_context == NULL ) || ( data == NULL ) ) {
+      fprintf( stderr, "%s: Out of memory\n", prg );
+      return EXIT_FAILURE;
+   }
+
+   if( ghz == 0 ) {
+      ghz = estimate_ghz();
+   }
+#if defined( _GNU_SOURCE ) && defined( __GLIBC__ )
+   fprintf( stdout, "clock: %.2f GHz, rfind: libc memrchr\n\n", ghz );
+#else
+   fprintf( stdout, "clock: %.2f GHz, rfind: vector_memrchr\n\n", ghz );
+#endif
+   fprintf( stdout, "%-18s %8s %8s %12s %12s\n", "kernel", "length", "prefix", "ns/op", "bytes/cycle" );
+
+   bench_le();
+   bench_search( "find", run_find, data );
+   bench_search( "rfind", run_rfind, data );
+   bench_search( "fallback_memrchr", run_fallback, data );
+   bench_search( "vector_memrchr", run_vector, data );
+
+   free( data );
+   lsort_destroy( fold_context );
+   lsort_destroy( context );
+   return EXIT_SUCCESS;
+}
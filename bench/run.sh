@@ -0,0 +1,70 @@
+#!/bin/sh
+# Copyright (c) 2019-2021 Daniel Frey
+# Distributed under the Boost Software License, Version 1.0.
+# (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+# Runs lsort over a matrix of generated inputs and reports the throughput,
+# the comparisons per line and the bytes moved per input byte.
+#
+# The matrix is configured with the following environment variables:
+#   SIZES        input sizes, default: 64M
+#   MODELS       disorder models, default: jitter late burst shards reverse
+#   LENGTHS      line length distributions, default: uniform:20-200
+#   ENGINES      lsort engines, default: insertion merge block external
+#   WIDTH        disorder width in lines, default: the generator's default
+#   PROBABILITY  probability of late lines or bursts, default: the generator's default
+#   LSORT_FLAGS  additional options for lsort
+#   LSORT, GEN   the binaries to use
+#   TMPDIR       where the inputs are generated
+
+set -e
+
+dir=$(dirname "$0")
+LSORT=${LSORT:-$dir/../lsort}
+GEN=${GEN:-$dir/gen}
+SIZES=${SIZES:-64M}
+MODELS=${MODELS:-"jitter late burst shards reverse"}
+LENGTHS=${LENGTHS:-"uniform:20-200"}
+ENGINES=${ENGINES:-"insertion merge block external"}
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/lsort-bench.XXXXXX")
+trap 'rm -rf "$work"' EXIT INT TERM
+
+field()
+{
+   printf '%s' "$total" | sed -n "s/.*\"$1\":\([0-9.]*\).*/\1/p"
+}
+
+printf '%-8s %-16s %-8s %-10s %10s %10s %10s  %s\n' size length model engine MB/s cmp/line moved/byte result
+for size in $SIZES; do
+   for length in $LENGTHS; do
+      for model in $MODELS; do
+         "$GEN" -s "$size" -m "$model" -l "$length" ${WIDTH:+-w "$WIDTH"} ${PROBABILITY:+-p "$PROBABILITY"} > "$work/input"
+         lines=$(wc -l < "$work/input")
+         for engine in $ENGINES; do
+            cp "$work/input" "$work/data"
+            if "$LSORT" -q --engine "$engine" --stats=json $LSORT_FLAGS "$work/data" 2> "$work/stats"; then
+               if "$LSORT" -C "$work/data" 2> /dev/null; then
+                  result=ok
+               else
+                  result=unsorted
+               fi
+            else
+               result=failed
+            fi
+            total=$(sed -n 's/.*\],"total"://p' "$work/stats")
+            if [ -z "$total" ]; then
+               printf '%-8s %-16s %-8s %-10s %10s %10s %10s  %s\n' "$size" "$length" "$model" "$engine" - - - "$result"
+               continue
+            fi
+            awk -v size="$size" -v distribution="$length" -v model="$model" -v engine="$engine" -v result="$result" \
+                -v bytes="$(field size)" -v lines="$lines" -v comparisons="$(field comparisons)" \
+                -v moved="$(field bytes_moved)" -v time="$(field total)" 'BEGIN {
+               if( time <= 0 ) time = 1e-9;
+               if( lines <= 0 ) lines = 1;
+               printf "%-8s %-16s %-8s %-10s %10.1f %10.2f %10.3f  %s\n", size, distribution, model, engine, bytes / 1e6 / time, comparisons / lines, moved / bytes, result
+            }'
+         done
+      done
+   done
+done
@@ -0,0 +1,1282 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+// Key extraction for sort(1)-style keys. The keys of a line are encoded into a
+// single byte string which compares like the keys with memcmp(), so the cached
+// keys of liblsort compare as fast as whole lines.
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lsort_internal.h"
+
+static int blank( char c )
+{
+   return ( c == ' ' ) || ( c == '\t' );
+}
+
+static const char* skip_blanks( const char* pos, const char* end )
+{
+   while( ( pos != end ) && blank( *pos ) ) {
+      ++pos;
+   }
+   return pos;
+}
+
+// the beginning of field (counted from 1), a field includes its leading blanks
+// unless there is a separator
+static const char* field_begin( const char* pos, const char* end, size_t field, int separator )
+{
+   while( --field != 0 ) {
+      if( separator >= 0 ) {
+         pos = (const char*)memchr( pos, separator, end - pos );
+         if( pos == NULL ) {
+            return end;
+         }
+         ++pos;
+      }
+      else {
+         pos = skip_blanks( pos, end );
+         while( ( pos != end ) && !blank( *pos ) ) {
+            ++pos;
+         }
+      }
+   }
+   return pos;
+}
+
+static const char* field_end( const char* pos, const char* end, int separator )
+{
+   if( separator >= 0 ) {
+      pos = (const char*)memchr( pos, separator, end - pos );
+      return ( pos != NULL ) ? pos : end;
+   }
+   pos = skip_blanks( pos, end );
+   while( ( pos != end ) && !blank( *pos ) ) {
+      ++pos;
+   }
+   return pos;
+}
+
+static const char* advance( const char* pos, const char* end, size_t n )
+{
+   return ( (size_t)( end - pos ) > n ) ? ( pos + n ) : end;
+}
+
+static size_t put( char* key, size_t capacity, size_t n, unsigned char c )
+{
+   if( n < capacity ) {
+      key[ n ] = c;
+   }
+   return n + 1;
+}
+
+// appends [begin, end) as is, only for the last key
+static size_t put_raw( char* key, size_t capacity, size_t n, const char* begin, const char* end )
+{
+   const size_t size = end - begin;
+   if( n + size <= capacity ) {
+      memcpy( key + n, begin, size );
+   }
+   return n + size;
+}
+
+// appends [begin, end) so that a shorter key compares less than any longer key
+// it is a prefix of: NUL is escaped as 0x00 0x01 and the key ends with 0x00 0x00;
+// with mask 0xff, the bytes are inverted to reverse the order
+static size_t put_terminated( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask )
+{
+   while( begin != end ) {
+      const char* nul = (const char*)memchr( begin, '\0', end - begin );
+      const char* stop = ( nul != NULL ) ? nul : end;
+      if( ( mask == 0 ) && ( n + ( stop - begin ) <= capacity ) ) {
+         memcpy( key + n, begin, stop - begin );
+         n += stop - begin;
+      }
+      else {
+         for( const char* pos = begin; pos != stop; ++pos ) {
+            n = put( key, capacity, n, (unsigned char)*pos ^ mask );
+         }
+      }
+      if( nul == NULL ) {
+         break;
+      }
+      n = put( key, capacity, n, mask );
+      n = put( key, capacity, n, 0x01 ^ mask );
+      begin = nul + 1;
+   }
+   n = put( key, capacity, n, mask );
+   return put( key, capacity, n, mask );
+}
+
+static int digit( char c )
+{
+   return ( c >= '0' ) && ( c <= '9' );
+}
+
+// appends a number like sort -n parses it, exactly and in any length: a class
+// byte (negative, zero, positive), the number of integer digits and the digits
+// without leading and trailing zeros, then a terminator; negative numbers are
+// inverted after the class byte
+static size_t put_numeric( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask )
+{
+   const char* pos = skip_blanks( begin, end );
+   const int negative = ( pos != end ) && ( *pos == '-' );
+   if( negative ) {
+      ++pos;
+   }
+   while( ( pos != end ) && ( *pos == '0' ) ) {
+      ++pos;
+   }
+   const char* const integer = pos;
+   while( ( pos != end ) && digit( *pos ) ) {
+      ++pos;
+   }
+   const char* const integer_end = pos;
+   const char* fraction = pos;
+   const char* fraction_end = pos;
+   if( ( pos != end ) && ( *pos == '.' ) ) {
+      fraction = ++pos;
+      while( ( pos != end ) && digit( *pos ) ) {
+         ++pos;
+      }
+      fraction_end = pos;
+      while( ( fraction_end != fraction ) && ( *( fraction_end - 1 ) == '0' ) ) {
+         --fraction_end;
+      }
+   }
+
+   if( ( integer == integer_end ) && ( fraction == fraction_end ) ) {
+      return put( key, capacity, n, 0x02 ^ mask );
+   }
+   const unsigned char sign = negative ? 0xff : 0;
+   n = put( key, capacity, n, ( negative ? 0x01 : 0x03 ) ^ mask );
+   const size_t digits = integer_end - integer;
+   const uint32_t length = ( digits > UINT32_MAX ) ? UINT32_MAX : digits;
+   for( int shift = 24; shift >= 0; shift -= 8 ) {
+      n = put( key, capacity, n, ( ( length >> shift ) & 0xff ) ^ sign ^ mask );
+   }
+   for( pos = integer; pos != integer_end; ++pos ) {
+      n = put( key, capacity, n, *pos ^ sign ^ mask );
+   }
+   for( pos = fraction; pos != fraction_end; ++pos ) {
+      n = put( key, capacity, n, *pos ^ sign ^ mask );
+   }
+   return put( key, capacity, n, sign ^ mask );
+}
+
+// appends a number with an SI suffix like sort -h compares it: by sign, then
+// by suffix, then by value; numbers that are zero have no suffix
+static size_t put_human( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask )
+{
+   const char* pos = skip_blanks( begin, end );
+   const int negative = ( pos != end ) && ( *pos == '-' );
+   if( negative ) {
+      ++pos;
+   }
+   int nonzero = 0;
+   while( ( pos != end ) && digit( *pos ) ) {
+      nonzero |= ( *pos++ != '0' );
+   }
+   if( ( pos != end ) && ( *pos == '.' ) ) {
+      ++pos;
+      while( ( pos != end ) && digit( *pos ) ) {
+         nonzero |= ( *pos++ != '0' );
+      }
+   }
+   int order = 0;
+   if( nonzero && ( pos != end ) ) {
+      const char* const units = "KMGTPEZYRQ";
+      const char* unit = ( *pos == 'k' ) ? units : (const char*)memchr( units, *pos, 10 );
+      if( unit != NULL ) {
+         order = unit - units + 1;
+      }
+   }
+   n = put( key, capacity, n, ( 0x10 + ( negative ? -order : order ) ) ^ mask );
+   return put_numeric( key, capacity, n, begin, end, mask );
+}
+
+static int alpha( char c )
+{
+   return ( ( c | 0x20 ) >= 'a' ) && ( ( c | 0x20 ) <= 'z' );
+}
+
+// byte values of the version encoding below, in the order of gnulib's
+// verrevcmp(): '~' before the end, the end before digits, digits before
+// letters and letters before all other characters
+enum
+{
+   VERSION_TILDE = 1,
+   VERSION_ZEROS_TILDE,  // zeros, followed by '~'
+   VERSION_END,
+   VERSION_ZEROS,  // zeros, followed by something else than '~' or the end
+   VERSION_DIGITS,
+   VERSION_ALPHA
+};
+
+static unsigned char version_rank( unsigned char c, int folded )
+{
+   if( folded && ( c >= 'a' ) && ( c <= 'z' ) ) {
+      c -= 0x20;
+   }
+   if( c == '~' ) {
+      return VERSION_TILDE;
+   }
+   if( alpha( c ) ) {
+      return ( c <= 'Z' ) ? ( VERSION_ALPHA + c - 'A' ) : ( VERSION_ALPHA + 26 + c - 'a' );
+   }
+   // the others keep their order after the letters, skipping over the
+   // digits, the letters and '~'
+   return VERSION_ALPHA + 52 + c - ( ( c > '9' ) ? 10 : 0 ) - ( ( c > 'Z' ) ? 26 : 0 ) - ( ( c > 'z' ) ? 26 : 0 ) - ( ( c > '~' ) ? 1 : 0 );
+}
+
+// appends [begin, end) so that the keys compare like gnulib's verrevcmp():
+// runs of digits compare by their value without leading zeros, other
+// characters one by one; the encoding ends with VERSION_END and is never the
+// prefix of another encoding, so it needs no terminator
+static size_t put_version_part( char* key, size_t capacity, size_t n, const char* pos, const char* end, int folded, unsigned char mask )
+{
+   for( ;; ) {
+      while( ( pos != end ) && !digit( *pos ) ) {
+         n = put( key, capacity, n, version_rank( *pos++, folded ) ^ mask );
+      }
+      while( ( pos != end ) && ( *pos == '0' ) ) {
+         ++pos;
+      }
+      if( pos == end ) {
+         return put( key, capacity, n, VERSION_END ^ mask );
+      }
+      if( !digit( *pos ) ) {
+         // a run of zeros compares against the end of the other version by
+         // what follows it
+         n = put( key, capacity, n, ( ( *pos == '~' ) ? VERSION_ZEROS_TILDE : VERSION_ZEROS ) ^ mask );
+         continue;
+      }
+      const char* const digits = pos;
+      while( ( pos != end ) && digit( *pos ) ) {
+         ++pos;
+      }
+      n = put( key, capacity, n, VERSION_DIGITS ^ mask );
+      const size_t size = pos - digits;
+      const uint32_t length = ( size > UINT32_MAX ) ? UINT32_MAX : size;
+      for( int shift = 24; shift >= 0; shift -= 8 ) {
+         n = put( key, capacity, n, ( ( length >> shift ) & 0xff ) ^ mask );
+      }
+      for( const char* p = digits; p != pos; ++p ) {
+         n = put( key, capacity, n, *p ^ mask );
+      }
+   }
+}
+
+// the length of [begin, end) without a file suffix, which is a run of '.'
+// followed by a letter or '~' and then letters, digits or '~', as often as
+// they come; names like ".bashrc" are all suffix
+static size_t version_prefix( const char* begin, const char* end )
+{
+   const size_t size = end - begin;
+   size_t prefix = 0;
+   for( size_t i = 0;; ) {
+      while( ( i + 1 < size ) && ( begin[ i ] == '.' ) && ( alpha( begin[ i + 1 ] ) || ( begin[ i + 1 ] == '~' ) ) ) {
+         for( i += 2; ( i < size ) && ( alpha( begin[ i ] ) || digit( begin[ i ] ) || ( begin[ i ] == '~' ) ); ++i ) {
+         }
+      }
+      if( i == size ) {
+         return prefix;
+      }
+      prefix = ++i;
+   }
+}
+
+// appends a version like sort -V compares it with gnulib's filenvercmp(): the
+// empty string, ".", ".." and other names starting with '.' go first, then
+// the names without their suffixes and then the whole names are compared
+static size_t put_version( char* key, size_t capacity, size_t n, const char* begin, const char* end, int folded, unsigned char mask )
+{
+   const size_t size = end - begin;
+   if( size == 0 ) {
+      return put( key, capacity, n, 0x01 ^ mask );
+   }
+   if( *begin == '.' ) {
+      if( size == 1 ) {
+         return put( key, capacity, n, 0x02 ^ mask );
+      }
+      if( ( size == 2 ) && ( begin[ 1 ] == '.' ) ) {
+         return put( key, capacity, n, 0x03 ^ mask );
+      }
+      n = put( key, capacity, n, 0x04 ^ mask );
+   }
+   else {
+      n = put( key, capacity, n, 0x05 ^ mask );
+   }
+   n = put_version_part( key, capacity, n, begin, begin + version_prefix( begin, end ), folded, mask );
+   return put_version_part( key, capacity, n, begin, end, folded, mask );
+}
+
+// appends a number like sort -g parses it, as a class byte (not a number, NaN,
+// number) and the bits of the double, transformed to compare as unsigned
+static size_t put_general( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask )
+{
+   char buffer[ 128 ];
+   const size_t size = ( (size_t)( end - begin ) < sizeof( buffer ) ) ? (size_t)( end - begin ) : ( sizeof( buffer ) - 1 );
+   memcpy( buffer, begin, size );
+   buffer[ size ] = '\0';
+   char* stop;
+   double value = strtod( buffer, &stop );
+   if( stop == buffer ) {
+      return put( key, capacity, n, 0x00 ^ mask );
+   }
+   if( value != value ) {
+      return put( key, capacity, n, 0x01 ^ mask );
+   }
+   if( value == 0 ) {
+      value = 0;
+   }
+   uint64_t bits;
+   memcpy( &bits, &value, sizeof( bits ) );
+   bits = ( bits >> 63 ) ? ~bits : ( bits | ( (uint64_t)1 << 63 ) );
+   n = put( key, capacity, n, 0x02 ^ mask );
+   for( int shift = 56; shift >= 0; shift -= 8 ) {
+      n = put( key, capacity, n, ( ( bits >> shift ) & 0xff ) ^ mask );
+   }
+   return n;
+}
+
+static const char* const months = "JanFebMarAprMayJunJulAugSepOctNovDec";
+
+// reads exactly count digits
+static const char* parse_digits( const char* pos, const char* end, int count, int* value )
+{
+   if( end - pos < count ) {
+      return NULL;
+   }
+   int result = 0;
+   for( int i = 0; i != count; ++i ) {
+      if( !digit( pos[ i ] ) ) {
+         return NULL;
+      }
+      result = result * 10 + ( pos[ i ] - '0' );
+   }
+   *value = result;
+   return pos + count;
+}
+
+static const char* parse_char( const char* pos, const char* end, char c )
+{
+   return ( ( pos != NULL ) && ( pos != end ) && ( *pos == c ) ) ? ( pos + 1 ) : NULL;
+}
+
+static const char* parse_month( const char* pos, const char* end, int* month )
+{
+   if( end - pos < 3 ) {
+      return NULL;
+   }
+   for( int i = 0; i != 12; ++i ) {
+      if( memcmp( pos, months + 3 * i, 3 ) == 0 ) {
+         *month = i + 1;
+         return pos + 3;
+      }
+   }
+   return NULL;
+}
+
+// reads an optional fraction of a second, digits beyond nanoseconds are ignored
+static const char* parse_fraction( const char* pos, const char* end, int64_t* ns )
+{
+   *ns = 0;
+   if( ( pos == end ) || ( ( *pos != '.' ) && ( *pos != ',' ) ) || ( pos + 1 == end ) || !digit( pos[ 1 ] ) ) {
+      return pos;
+   }
+   int64_t scale = 100000000;
+   for( ++pos; ( pos != end ) && digit( *pos ); ++pos ) {
+      *ns += ( *pos - '0' ) * scale;
+      scale /= 10;
+   }
+   return pos;
+}
+
+// days since 1970-01-01 in the proleptic Gregorian calendar
+static int64_t days_from_civil( int64_t year, int month, int day )
+{
+   year -= ( month <= 2 );
+   const int64_t era = ( ( year >= 0 ) ? year : ( year - 399 ) ) / 400;
+   const int64_t yoe = year - era * 400;
+   const int64_t doy = ( 153 * ( ( month > 2 ) ? ( month - 3 ) : ( month + 9 ) ) + 2 ) / 5 + day - 1;
+   const int64_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+   return era * 146097 + doe - 719468;
+}
+
+static int valid_time( int month, int day, int hour, int minute, int second )
+{
+   return ( month >= 1 ) && ( month <= 12 ) && ( day >= 1 ) && ( day <= 31 ) && ( hour <= 24 ) && ( minute <= 59 ) && ( second <= 60 );
+}
+
+// nanoseconds since the epoch, saturated to the range of int64_t
+static int64_t to_ns( int year, int month, int day, int hour, int minute, int second, int64_t fraction, int offset )
+{
+   const int64_t seconds = days_from_civil( year, month, day ) * 86400 + hour * 3600 + minute * 60 + second - offset;
+   if( seconds >= INT64_MAX / 1000000000 ) {
+      return INT64_MAX;
+   }
+   if( seconds <= INT64_MIN / 1000000000 ) {
+      return INT64_MIN;
+   }
+   return seconds * 1000000000 + fraction;
+}
+
+// Z, +hh, +hh:mm or +hhmm, in seconds
+static const char* parse_offset( const char* pos, const char* end, int* offset )
+{
+   *offset = 0;
+   if( pos == end ) {
+      return pos;
+   }
+   if( ( *pos == 'Z' ) || ( *pos == 'z' ) ) {
+      return pos + 1;
+   }
+   if( ( *pos != '+' ) && ( *pos != '-' ) ) {
+      return pos;
+   }
+   const int sign = ( *pos == '-' ) ? -1 : 1;
+   int hours;
+   int minutes = 0;
+   const char* p = parse_digits( pos + 1, end, 2, &hours );
+   if( p == NULL ) {
+      return pos;
+   }
+   const char* q = parse_digits( ( ( p != end ) && ( *p == ':' ) ) ? ( p + 1 ) : p, end, 2, &minutes );
+   if( q != NULL ) {
+      p = q;
+   }
+   *offset = sign * ( hours * 3600 + minutes * 60 );
+   return p;
+}
+
+// 2021-03-04[(T| )05:06[:07[.123]]][Z|+01:00]
+static int parse_iso( const char* pos, const char* end, int64_t* ns )
+{
+   int year;
+   int month;
+   int day;
+   int hour = 0;
+   int minute = 0;
+   int second = 0;
+   int64_t fraction = 0;
+   int offset = 0;
+   pos = parse_digits( pos, end, 4, &year );
+   pos = parse_char( pos, end, '-' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &month ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, '-' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &day ) ) == NULL ) ) {
+      return 0;
+   }
+   if( ( end - pos >= 6 ) && ( ( *pos == 'T' ) || ( *pos == 't' ) || ( *pos == ' ' ) ) && digit( pos[ 1 ] ) ) {
+      const char* p = parse_digits( pos + 1, end, 2, &hour );
+      p = parse_char( p, end, ':' );
+      if( ( p == NULL ) || ( ( p = parse_digits( p, end, 2, &minute ) ) == NULL ) ) {
+         return 0;
+      }
+      const char* q = parse_char( p, end, ':' );
+      if( ( q != NULL ) && ( ( q = parse_digits( q, end, 2, &second ) ) != NULL ) ) {
+         p = parse_fraction( q, end, &fraction );
+      }
+      parse_offset( p, end, &offset );
+   }
+   if( !valid_time( month, day, hour, minute, second ) ) {
+      return 0;
+   }
+   *ns = to_ns( year, month, day, hour, minute, second, fraction, offset );
+   return 1;
+}
+
+// 04/Mar/2021:05:06:07 +0100
+static int parse_clf( const char* pos, const char* end, int64_t* ns )
+{
+   int day;
+   int month;
+   int year;
+   int hour;
+   int minute;
+   int second;
+   int offset = 0;
+   pos = parse_char( parse_digits( pos, end, 2, &day ), end, '/' );
+   if( ( pos == NULL ) || ( ( pos = parse_month( pos, end, &month ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, '/' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 4, &year ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, ':' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &hour ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, ':' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &minute ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, ':' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &second ) ) == NULL ) ) {
+      return 0;
+   }
+   if( ( pos != end ) && ( *pos == ' ' ) ) {
+      parse_offset( pos + 1, end, &offset );
+   }
+   if( !valid_time( month, day, hour, minute, second ) ) {
+      return 0;
+   }
+   *ns = to_ns( year, month, day, hour, minute, second, 0, offset );
+   return 1;
+}
+
+// Mar  4 05:06:07[.123]
+static int parse_syslog( const char* pos, const char* end, int64_t* ns )
+{
+   int month;
+   int day;
+   int hour;
+   int minute;
+   int second;
+   int64_t fraction;
+   pos = parse_month( pos, end, &month );
+   pos = parse_char( pos, end, ' ' );
+   if( ( pos != NULL ) && ( pos != end ) && ( *pos == ' ' ) ) {
+      ++pos;
+   }
+   if( ( pos == NULL ) || ( pos == end ) || !digit( *pos ) ) {
+      return 0;
+   }
+   day = *pos++ - '0';
+   if( ( pos != end ) && digit( *pos ) ) {
+      day = day * 10 + ( *pos++ - '0' );
+   }
+   pos = parse_char( pos, end, ' ' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &hour ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, ':' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &minute ) ) == NULL ) ) {
+      return 0;
+   }
+   pos = parse_char( pos, end, ':' );
+   if( ( pos == NULL ) || ( ( pos = parse_digits( pos, end, 2, &second ) ) == NULL ) ) {
+      return 0;
+   }
+   parse_fraction( pos, end, &fraction );
+   if( !valid_time( month, day, hour, minute, second ) ) {
+      return 0;
+   }
+   *ns = to_ns( 1970, month, day, hour, minute, second, fraction, 0 );
+   return 1;
+}
+
+static int parse_time( const char* pos, const char* end, int64_t* ns )
+{
+   pos = skip_blanks( pos, end );
+   if( ( pos != end ) && ( *pos == '[' ) ) {
+      ++pos;
+   }
+   return parse_iso( pos, end, ns ) || parse_clf( pos, end, ns ) || parse_syslog( pos, end, ns );
+}
+
+// appends a class byte (no timestamp, timestamp) and the nanoseconds since the
+// epoch, transformed to compare as unsigned
+static size_t put_time( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask )
+{
+   int64_t ns;
+   if( !parse_time( begin, end, &ns ) ) {
+      const char* bracket = (const char*)memchr( begin, '[', end - begin );
+      if( ( bracket == NULL ) || !parse_time( bracket, end, &ns ) ) {
+         return put( key, capacity, n, 0x00 ^ mask );
+      }
+   }
+   const uint64_t bits = (uint64_t)ns ^ ( (uint64_t)1 << 63 );
+   n = put( key, capacity, n, 0x01 ^ mask );
+   for( int shift = 56; shift >= 0; shift -= 8 ) {
+      n = put( key, capacity, n, ( ( bits >> shift ) & 0xff ) ^ mask );
+   }
+   return n;
+}
+
+// the first '"' or backslash in [pos, end), or end
+static const char* find_quote( const char* pos, const char* end )
+{
+#if defined( LSORT_X86 )
+   const __m128i quote = _mm_set1_epi8( '"' );
+   const __m128i backslash = _mm_set1_epi8( '\\' );
+   while( end - pos >= 16 ) {
+      const __m128i v = _mm_loadu_si128( (const __m128i*)pos );
+      const unsigned mask = _mm_movemask_epi8( _mm_or_si128( _mm_cmpeq_epi8( v, quote ), _mm_cmpeq_epi8( v, backslash ) ) );
+      if( mask != 0 ) {
+         return pos + __builtin_ctz( mask );
+      }
+      pos += 16;
+   }
+#elif defined( LSORT_NEON )
+   const uint8x16_t quote = vdupq_n_u8( '"' );
+   const uint8x16_t backslash = vdupq_n_u8( '\\' );
+   while( end - pos >= 16 ) {
+      const uint8x16_t v = vld1q_u8( (const uint8_t*)pos );
+      const uint8x16_t eq = vorrq_u8( vceqq_u8( v, quote ), vceqq_u8( v, backslash ) );
+      // four bits per byte
+      const uint64_t mask = vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( vreinterpretq_u16_u8( eq ), 4 ) ), 0 );
+      if( mask != 0 ) {
+         return pos + __builtin_ctzll( mask ) / 4;
+      }
+      pos += 16;
+   }
+#endif
+   while( ( pos != end ) && ( *pos != '"' ) && ( *pos != '\\' ) ) {
+      ++pos;
+   }
+   return pos;
+}
+
+// the first '"', '{', '}', '[' or ']' in [pos, end), or end; '[' and ']'
+// differ from '{' and '}' only in bit 0x20
+static const char* find_structural( const char* pos, const char* end )
+{
+#if defined( LSORT_X86 )
+   const __m128i quote = _mm_set1_epi8( '"' );
+   const __m128i open = _mm_set1_epi8( '{' );
+   const __m128i close = _mm_set1_epi8( '}' );
+   const __m128i bit = _mm_set1_epi8( 0x20 );
+   while( end - pos >= 16 ) {
+      const __m128i v = _mm_loadu_si128( (const __m128i*)pos );
+      const __m128i folded = _mm_or_si128( v, bit );
+      const __m128i eq = _mm_or_si128( _mm_cmpeq_epi8( v, quote ), _mm_or_si128( _mm_cmpeq_epi8( folded, open ), _mm_cmpeq_epi8( folded, close ) ) );
+      const unsigned mask = _mm_movemask_epi8( eq );
+      if( mask != 0 ) {
+         return pos + __builtin_ctz( mask );
+      }
+      pos += 16;
+   }
+#elif defined( LSORT_NEON )
+   const uint8x16_t quote = vdupq_n_u8( '"' );
+   const uint8x16_t open = vdupq_n_u8( '{' );
+   const uint8x16_t close = vdupq_n_u8( '}' );
+   const uint8x16_t bit = vdupq_n_u8( 0x20 );
+   while( end - pos >= 16 ) {
+      const uint8x16_t v = vld1q_u8( (const uint8_t*)pos );
+      const uint8x16_t folded = vorrq_u8( v, bit );
+      const uint8x16_t eq = vorrq_u8( vceqq_u8( v, quote ), vorrq_u8( vceqq_u8( folded, open ), vceqq_u8( folded, close ) ) );
+      const uint64_t mask = vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( vreinterpretq_u16_u8( eq ), 4 ) ), 0 );
+      if( mask != 0 ) {
+         return pos + __builtin_ctzll( mask ) / 4;
+      }
+      pos += 16;
+   }
+#endif
+   while( ( pos != end ) && ( *pos != '"' ) && ( ( *pos | 0x20 ) != '{' ) && ( ( *pos | 0x20 ) != '}' ) ) {
+      ++pos;
+   }
+   return pos;
+}
+
+static const char* skip_space( const char* pos, const char* end )
+{
+   while( ( pos != end ) && ( ( *pos == ' ' ) || ( *pos == '\t' ) || ( *pos == '\r' ) || ( *pos == '\n' ) ) ) {
+      ++pos;
+   }
+   return pos;
+}
+
+// pos is at the opening quote, returns the position after the closing quote or NULL
+static const char* skip_string( const char* pos, const char* end )
+{
+   ++pos;
+   for( ;; ) {
+      pos = find_quote( pos, end );
+      if( pos == end ) {
+         return NULL;
+      }
+      if( *pos == '"' ) {
+         return pos + 1;
+      }
+      if( end - pos < 2 ) {
+         return NULL;
+      }
+      pos += 2;
+   }
+}
+
+// pos is at '{' or '[', returns the position after the matching bracket or NULL
+static const char* skip_nested( const char* pos, const char* end )
+{
+   size_t depth = 0;
+   for( ;; ) {
+      pos = find_structural( pos, end );
+      if( pos == end ) {
+         return NULL;
+      }
+      if( *pos == '"' ) {
+         pos = skip_string( pos, end );
+         if( pos == NULL ) {
+            return NULL;
+         }
+         continue;
+      }
+      if( ( *pos | 0x20 ) == '{' ) {
+         ++depth;
+      }
+      else if( --depth == 0 ) {
+         return pos + 1;
+      }
+      ++pos;
+   }
+}
+
+static const char* skip_value( const char* pos, const char* end )
+{
+   if( *pos == '"' ) {
+      return skip_string( pos, end );
+   }
+   if( ( *pos | 0x20 ) == '{' ) {
+      return skip_nested( pos, end );
+   }
+   while( ( pos != end ) && ( *pos != ',' ) && ( *pos != '}' ) && ( *pos != ']' ) && ( *pos != ' ' ) && ( *pos != '\t' ) && ( *pos != '\r' ) ) {
+      ++pos;
+   }
+   return pos;
+}
+
+// finds the value of a top-level field of the object in [pos, end) without
+// parsing the values of other fields, only skipping over them
+static int find_json( const char* pos, const char* end, const char* name, const char** value, const char** value_end )
+{
+   const size_t size = strlen( name );
+   pos = skip_space( pos, end );
+   if( ( pos == end ) || ( *pos != '{' ) ) {
+      return 0;
+   }
+   ++pos;
+   for( ;; ) {
+      pos = skip_space( pos, end );
+      if( ( pos == end ) || ( *pos != '"' ) ) {
+         return 0;
+      }
+      const char* const field = pos + 1;
+      pos = skip_string( pos, end );
+      if( pos == NULL ) {
+         return 0;
+      }
+      const char* const field_end = pos - 1;
+      pos = skip_space( pos, end );
+      if( ( pos == end ) || ( *pos != ':' ) ) {
+         return 0;
+      }
+      pos = skip_space( pos + 1, end );
+      if( pos == end ) {
+         return 0;
+      }
+      const char* const begin = pos;
+      pos = skip_value( pos, end );
+      if( pos == NULL ) {
+         return 0;
+      }
+      if( ( (size_t)( field_end - field ) == size ) && ( memcmp( field, name, size ) == 0 ) ) {
+         *value = begin;
+         *value_end = pos;
+         return 1;
+      }
+      pos = skip_space( pos, end );
+      if( ( pos == end ) || ( *pos != ',' ) ) {
+         return 0;
+      }
+      ++pos;
+   }
+}
+
+static int hex( char c )
+{
+   if( digit( c ) ) {
+      return c - '0';
+   }
+   c |= 0x20;
+   return ( ( c >= 'a' ) && ( c <= 'f' ) ) ? ( c - 'a' + 10 ) : -1;
+}
+
+static int parse_hex4( const char* pos, const char* end, unsigned* value )
+{
+   if( end - pos < 4 ) {
+      return 0;
+   }
+   *value = 0;
+   for( int i = 0; i != 4; ++i ) {
+      const int h = hex( pos[ i ] );
+      if( h < 0 ) {
+         return 0;
+      }
+      *value = *value * 16 + h;
+   }
+   return 1;
+}
+
+// decodes the escapes of the contents of a JSON string into out, which must
+// have room for end - pos bytes; invalid escapes are kept as they are
+static size_t unescape( const char* pos, const char* end, char* out )
+{
+   char* write = out;
+   while( pos != end ) {
+      const char* backslash = (const char*)memchr( pos, '\\', end - pos );
+      if( backslash == NULL ) {
+         backslash = end;
+      }
+      memcpy( write, pos, backslash - pos );
+      write += backslash - pos;
+      pos = backslash;
+      if( ( pos == end ) || ( end - pos < 2 ) ) {
+         break;
+      }
+      const char c = pos[ 1 ];
+      const char* const simple = "\"\"\\\\//b\bf\fn\nr\rt\t";
+      const char* found = NULL;
+      for( const char* p = simple; *p != '\0'; p += 2 ) {
+         if( *p == c ) {
+            found = p;
+            break;
+         }
+      }
+      if( found != NULL ) {
+         *write++ = found[ 1 ];
+         pos += 2;
+         continue;
+      }
+      unsigned code;
+      if( ( c != 'u' ) || !parse_hex4( pos + 2, end, &code ) ) {
+         *write++ = *pos++;
+         continue;
+      }
+      size_t used = 6;
+      unsigned low;
+      if( ( code >= 0xd800 ) && ( code < 0xdc00 ) && ( end - pos >= 12 ) && ( pos[ 6 ] == '\\' ) && ( pos[ 7 ] == 'u' ) && parse_hex4( pos + 8, end, &low ) && ( low >= 0xdc00 ) && ( low < 0xe000 ) ) {
+         code = 0x10000 + ( ( code - 0xd800 ) << 10 ) + ( low - 0xdc00 );
+         used = 12;
+      }
+      if( code < 0x80 ) {
+         *write++ = (char)code;
+      }
+      else if( code < 0x800 ) {
+         *write++ = (char)( 0xc0 | ( code >> 6 ) );
+         *write++ = (char)( 0x80 | ( code & 0x3f ) );
+      }
+      else if( code < 0x10000 ) {
+         *write++ = (char)( 0xe0 | ( code >> 12 ) );
+         *write++ = (char)( 0x80 | ( ( code >> 6 ) & 0x3f ) );
+         *write++ = (char)( 0x80 | ( code & 0x3f ) );
+      }
+      else {
+         *write++ = (char)( 0xf0 | ( code >> 18 ) );
+         *write++ = (char)( 0x80 | ( ( code >> 12 ) & 0x3f ) );
+         *write++ = (char)( 0x80 | ( ( code >> 6 ) & 0x3f ) );
+         *write++ = (char)( 0x80 | ( code & 0x3f ) );
+      }
+      pos += used;
+   }
+   return write - out;
+}
+
+static size_t put_text( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask, int last )
+{
+   if( last && ( mask == 0 ) ) {
+      return put_raw( key, capacity, n, begin, end );
+   }
+   return put_terminated( key, capacity, n, begin, end, mask );
+}
+
+// folds the lower case ASCII letters of [pos, end) to upper case, the bytes are
+// xor'ed with mask, so that keys which are already encoded can be folded
+static void fold( char* pos, char* end, unsigned char mask )
+{
+#if defined( LSORT_X86 )
+   const __m128i bits = _mm_set1_epi8( (char)mask );
+   while( end - pos >= 16 ) {
+      const __m128i v = _mm_xor_si128( _mm_loadu_si128( (const __m128i*)pos ), bits );
+      const __m128i lower = _mm_and_si128( _mm_cmpgt_epi8( v, _mm_set1_epi8( 'a' - 1 ) ), _mm_cmplt_epi8( v, _mm_set1_epi8( 'z' + 1 ) ) );
+      _mm_storeu_si128( (__m128i*)pos, _mm_xor_si128( _mm_sub_epi8( v, _mm_and_si128( lower, _mm_set1_epi8( 0x20 ) ) ), bits ) );
+      pos += 16;
+   }
+#elif defined( LSORT_NEON )
+   const uint8x16_t bits = vdupq_n_u8( mask );
+   while( end - pos >= 16 ) {
+      const uint8x16_t v = veorq_u8( vld1q_u8( (const uint8_t*)pos ), bits );
+      const uint8x16_t lower = vandq_u8( vcgeq_u8( v, vdupq_n_u8( 'a' ) ), vcleq_u8( v, vdupq_n_u8( 'z' ) ) );
+      vst1q_u8( (uint8_t*)pos, veorq_u8( vsubq_u8( v, vandq_u8( lower, vdupq_n_u8( 0x20 ) ) ), bits ) );
+      pos += 16;
+   }
+#endif
+   for( ; pos != end; ++pos ) {
+      const unsigned char c = (unsigned char)*pos ^ mask;
+      if( (unsigned char)( c - 'a' ) < 26 ) {
+         *pos = (char)( ( c - 0x20 ) ^ mask );
+      }
+   }
+}
+
+// grows an arena of the context to at least n bytes, keeping its contents;
+// returns NULL if it cannot
+static char* room( struct arena* arena, size_t n )
+{
+   if( arena->capacity < n ) {
+      size_t capacity = ( arena->capacity == 0 ) ? 256 : arena->capacity;
+      while( capacity < n ) {
+         capacity *= 2;
+      }
+      char* tmp = (char*)realloc( arena->data, capacity );
+      if( tmp == NULL ) {
+         return NULL;
+      }
+      arena->data = tmp;
+      arena->capacity = capacity;
+   }
+   return arena->data;
+}
+
+// the strxfrm() of each NUL-separated part, separated by NUL; as strxfrm()
+// never yields NUL, the parts compare one after the other like strcoll() would
+static size_t put_collated( struct lsort* lsort, char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned flags, unsigned char mask, int last )
+{
+   const size_t size = end - begin;
+   char* const text = room( &lsort->collate[ 0 ], size + 1 );
+   char* out = room( &lsort->collate[ 1 ], 2 * size + 16 );
+   if( ( text == NULL ) || ( out == NULL ) ) {
+      return put_text( key, capacity, n, begin, end, mask, last );
+   }
+   memcpy( text, begin, size );
+   text[ size ] = '\0';
+   if( flags & LSORT_KEY_FOLD ) {
+      fold( text, text + size, 0 );
+   }
+   size_t limit = lsort->collate[ 1 ].capacity;
+   size_t length = 0;
+   for( const char* part = text;; ) {
+      const size_t need = strxfrm( out + length, part, limit - length );
+      if( need >= limit - length ) {
+         out = room( &lsort->collate[ 1 ], length + need + 1 + size );
+         if( out == NULL ) {
+            return put_text( key, capacity, n, begin, end, mask, last );
+         }
+         limit = lsort->collate[ 1 ].capacity;
+         continue;
+      }
+      length += need;
+      part += strlen( part ) + 1;
+      if( part > text + size ) {
+         break;
+      }
+      out[ length++ ] = '\0';
+   }
+   return put_text( key, capacity, n, out, out + length, mask, last );
+}
+
+static size_t put_string( struct lsort* lsort, char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned flags, unsigned char mask, int last )
+{
+   if( flags & LSORT_KEY_COLLATE ) {
+      return put_collated( lsort, key, capacity, n, begin, end, flags, mask, last );
+   }
+   const size_t start = n;
+   n = put_text( key, capacity, n, begin, end, mask, last );
+   if( ( flags & LSORT_KEY_FOLD ) && ( start < capacity ) ) {
+      // the escapes of put_terminated() are no letters
+      fold( key + start, key + ( ( n < capacity ) ? n : capacity ), mask );
+   }
+   return n;
+}
+
+static size_t put_typed( struct lsort* lsort, char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned flags, unsigned char mask, int last )
+{
+   if( flags & LSORT_KEY_NUMERIC ) {
+      return put_numeric( key, capacity, n, begin, end, mask );
+   }
+   if( flags & LSORT_KEY_GENERAL ) {
+      return put_general( key, capacity, n, begin, end, mask );
+   }
+   if( flags & LSORT_KEY_TIME ) {
+      return put_time( key, capacity, n, begin, end, mask );
+   }
+   if( flags & LSORT_KEY_HUMAN ) {
+      return put_human( key, capacity, n, begin, end, mask );
+   }
+   if( flags & LSORT_KEY_VERSION ) {
+      return put_version( key, capacity, n, begin, end, ( flags & LSORT_KEY_FOLD ) != 0, mask );
+   }
+   return put_string( lsort, key, capacity, n, begin, end, flags, mask, last );
+}
+
+// appends a JSON number exactly, in any length: a class byte (negative, zero,
+// positive), the decimal exponent of its first significant digit and the
+// significant digits without leading and trailing zeros, then a terminator;
+// negative numbers are inverted after the class byte
+static size_t put_decimal( char* key, size_t capacity, size_t n, const char* begin, const char* end, unsigned char mask )
+{
+   const char* pos = begin;
+   const int negative = ( pos != end ) && ( *pos == '-' );
+   if( negative ) {
+      ++pos;
+   }
+   const char* const integer = pos;
+   while( ( pos != end ) && digit( *pos ) ) {
+      ++pos;
+   }
+   const char* const integer_end = pos;
+   const char* fraction = pos;
+   const char* fraction_end = pos;
+   if( ( pos != end ) && ( *pos == '.' ) ) {
+      fraction = ++pos;
+      while( ( pos != end ) && digit( *pos ) ) {
+         ++pos;
+      }
+      fraction_end = pos;
+   }
+   int64_t exponent = 0;
+   if( ( pos != end ) && ( ( *pos == 'e' ) || ( *pos == 'E' ) ) ) {
+      const int minus = ( ++pos != end ) && ( *pos == '-' );
+      if( ( pos != end ) && ( ( *pos == '-' ) || ( *pos == '+' ) ) ) {
+         ++pos;
+      }
+      // exponents beyond any sensible number saturate
+      while( ( pos != end ) && digit( *pos ) ) {
+         if( exponent < INT64_MAX / 100 ) {
+            exponent = exponent * 10 + ( *pos - '0' );
+         }
+         ++pos;
+      }
+      if( minus ) {
+         exponent = -exponent;
+      }
+   }
+
+   const char* first = integer;
+   while( ( first != integer_end ) && ( *first == '0' ) ) {
+      ++first;
+   }
+   if( first != integer_end ) {
+      exponent += integer_end - first;
+   }
+   else {
+      first = fraction;
+      while( ( first != fraction_end ) && ( *first == '0' ) ) {
+         ++first;
+      }
+      if( first == fraction_end ) {
+         return put( key, capacity, n, 0x02 ^ mask );
+      }
+      exponent -= first - fraction;
+   }
+   const char* last = fraction_end;
+   while( ( last != fraction ) && ( *( last - 1 ) == '0' ) ) {
+      --last;
+   }
+   if( last == fraction ) {
+      last = integer_end;
+      while( *( last - 1 ) == '0' ) {
+         --last;
+      }
+   }
+
+   const unsigned char sign = negative ? 0xff : 0;
+   n = put( key, capacity, n, ( negative ? 0x01 : 0x03 ) ^ mask );
+   const uint64_t biased = (uint64_t)exponent ^ ( (uint64_t)1 << 63 );
+   for( int shift = 56; shift >= 0; shift -= 8 ) {
+      n = put( key, capacity, n, ( ( biased >> shift ) & 0xff ) ^ sign ^ mask );
+   }
+   for( pos = first; pos != last; ++pos ) {
+      if( pos == integer_end ) {
+         pos = fraction;
+      }
+      n = put( key, capacity, n, *pos ^ sign ^ mask );
+   }
+   return put( key, capacity, n, sign ^ mask );
+}
+
+// appends a class byte (missing, null, false, true, number, string, other) and the value
+static size_t put_json( struct lsort* lsort, char* key, size_t capacity, size_t n, const char* begin, const char* end, const struct lsort_key* k, unsigned char mask, int last )
+{
+   const char* value;
+   const char* value_end;
+   if( !find_json( begin, end, k->json, &value, &value_end ) ) {
+      return put( key, capacity, n, 0x00 ^ mask );
+   }
+   const int string = ( *value == '"' );
+   if( string ) {
+      ++value;
+      --value_end;
+   }
+   if( k->flags & ( LSORT_KEY_NUMERIC | LSORT_KEY_GENERAL | LSORT_KEY_TIME | LSORT_KEY_HUMAN | LSORT_KEY_VERSION ) ) {
+      n = put( key, capacity, n, 0x01 ^ mask );
+      return put_typed( lsort, key, capacity, n, value, value_end, k->flags, mask, last );
+   }
+   if( string ) {
+      n = put( key, capacity, n, 0x05 ^ mask );
+      if( memchr( value, '\\', value_end - value ) == NULL ) {
+         return put_string( lsort, key, capacity, n, value, value_end, k->flags, mask, last );
+      }
+      // escapes never decode to more bytes than they take
+      char* decoded = (char*)malloc( value_end - value );
+      if( decoded == NULL ) {
+         return put_text( key, capacity, n, value, value_end, mask, last );
+      }
+      const size_t size = unescape( value, value_end, decoded );
+      n = put_string( lsort, key, capacity, n, decoded, decoded + size, k->flags, mask, last );
+      free( decoded );
+      return n;
+   }
+   const size_t size = value_end - value;
+   if( ( size == 4 ) && ( memcmp( value, "null", 4 ) == 0 ) ) {
+      return put( key, capacity, n, 0x01 ^ mask );
+   }
+   if( ( size == 5 ) && ( memcmp( value, "false", 5 ) == 0 ) ) {
+      return put( key, capacity, n, 0x02 ^ mask );
+   }
+   if( ( size == 4 ) && ( memcmp( value, "true", 4 ) == 0 ) ) {
+      return put( key, capacity, n, 0x03 ^ mask );
+   }
+   if( ( value != value_end ) && ( ( *value == '-' ) || digit( *value ) ) ) {
+      n = put( key, capacity, n, 0x04 ^ mask );
+      return put_decimal( key, capacity, n, value, value_end, mask );
+   }
+   n = put( key, capacity, n, 0x06 ^ mask );
+   return put_text( key, capacity, n, value, value_end, mask, last );
+}
+
+size_t lsort_extract_keys( const char* line, size_t size, char* key, size_t capacity, void* arg )
+{
+   struct lsort* const lsort = (struct lsort*)arg;
+   const struct lsort_options* options = &lsort->options;
+   const char* const end = line + size;
+   size_t n = 0;
+   for( size_t i = 0; i != options->key_count; ++i ) {
+      const struct lsort_key* k = &options->keys[ i ];
+
+      const char* begin = field_begin( line, end, k->begin_field, options->separator );
+      if( k->flags & LSORT_KEY_BLANKS ) {
+         begin = skip_blanks( begin, end );
+      }
+      begin = advance( begin, end, k->begin_char - 1 );
+
+      const char* stop = end;
+      if( k->end_field != 0 ) {
+         stop = field_begin( line, end, k->end_field, options->separator );
+         if( k->end_char == 0 ) {
+            stop = field_end( stop, end, options->separator );
+         }
+         else {
+            if( k->flags & LSORT_KEY_END_BLANKS ) {
+               stop = skip_blanks( stop, end );
+            }
+            stop = advance( stop, end, k->end_char );
+         }
+      }
+      if( stop < begin ) {
+         stop = begin;
+      }
+
+      const unsigned char mask = ( k->flags & LSORT_KEY_REVERSE ) ? 0xff : 0;
+      const int last = ( i + 1 == options->key_count );
+      if( k->json != NULL ) {
+         n = put_json( lsort, key, capacity, n, begin, stop, k, mask, last );
+      }
+      else {
+         n = put_typed( lsort, key, capacity, n, begin, stop, k->flags, mask, last );
+      }
+   }
+   return n;
+}
+
+static const char* parse_number( const char* p, size_t* value )
+{
+   if( ( *p < '0' ) || ( *p > '9' ) ) {
+      return NULL;
+   }
+   size_t result = 0;
+   while( ( *p >= '0' ) && ( *p <= '9' ) ) {
+      const size_t next = result * 10 + ( *p++ - '0' );
+      if( next / 10 != result ) {
+         return NULL;
+      }
+      result = next;
+   }
+   *value = result;
+   return p;
+}
+
+// b applies to the position it follows
+static const char* parse_flags( const char* p, unsigned* flags, unsigned blanks )
+{
+   for( ;; ++p ) {
+      switch( *p ) {
+         case 'b':
+            *flags |= blanks;
+            break;
+         case 'r':
+            *flags |= LSORT_KEY_REVERSE;
+            break;
+         case 'n':
+            *flags |= LSORT_KEY_NUMERIC;
+            break;
+         case 'g':
+            *flags |= LSORT_KEY_GENERAL;
+            break;
+         case 'c':
+            *flags |= LSORT_KEY_COLLATE;
+            break;
+         case 'T':
+            *flags |= LSORT_KEY_TIME;
+            break;
+         case 'f':
+            *flags |= LSORT_KEY_FOLD;
+            break;
+         case 'h':
+            *flags |= LSORT_KEY_HUMAN;
+            break;
+         case 'V':
+            *flags |= LSORT_KEY_VERSION;
+            break;
+         default:
+            return p;
+      }
+   }
+}
+
+int lsort_parse_key( const char* text, struct lsort_key* key )
+{
+   memset( key, 0, sizeof( *key ) );
+   key->begin_char = 1;
+   const char* p = parse_number( text, &key->begin_field );
+   if( ( p == NULL ) || ( key->begin_field == 0 ) ) {
+      return -1;
+   }
+   if( *p == '.' ) {
+      p = parse_number( p + 1, &key->begin_char );
+      if( ( p == NULL ) || ( key->begin_char == 0 ) ) {
+         return -1;
+      }
+   }
+   p = parse_flags( p, &key->flags, LSORT_KEY_BLANKS );
+   if( *p == ',' ) {
+      p = parse_number( p + 1, &key->end_field );
+      if( ( p == NULL ) || ( key->end_field == 0 ) ) {
+         return -1;
+      }
+      if( *p == '.' ) {
+         p = parse_number( p + 1, &key->end_char );
+         if( p == NULL ) {
+            return -1;
+         }
+      }
+      p = parse_flags( p, &key->flags, LSORT_KEY_END_BLANKS );
+   }
+   if( ( *p != '\0' ) || !lsort_key_flags_valid( key->flags ) ) {
+      return -1;
+   }
+   return 0;
+}
+
+int lsort_key_flags_valid( unsigned flags )
+{
+   const unsigned orderings = flags & ( LSORT_KEY_NUMERIC | LSORT_KEY_GENERAL | LSORT_KEY_TIME | LSORT_KEY_COLLATE | LSORT_KEY_HUMAN | LSORT_KEY_VERSION );
+   return ( orderings & ( orderings - 1 ) ) == 0;
+}
@@ -0,0 +1,2608 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include "lsort_internal.h"
+
+const char* lsort_engine_names[] = { "auto", "insertion", "merge", "block", "external", NULL };
+const char* lsort_framing_names[] = { "none", "varint", "le32", "be32", NULL };
+const char* lsort_phase_names[] = { "scan", "search", "move", "sync", "sort", NULL };
+const char* lsort_counter_names[] = { "cycles", "instructions", "llc_misses", "dtlb_misses", "page_faults", NULL };
+
+// the context of the running qsort() in this thread, qsort() has no argument for it
+static _Thread_local struct lsort* sorting = NULL;
+
+static size_t zmin( size_t a, size_t b )
+{
+   return ( a < b ) ? a : b;
+}
+
+static char* cmin( char* a, char* b )
+{
+   return ( a == NULL ) ? b : ( ( a < b ) ? a : b );
+}
+
+static char* cmax( char* a, char* b )
+{
+   return ( a == NULL ) ? b : ( ( a > b ) ? a : b );
+}
+
+double lsort_now( void )
+{
+   struct timespec ts;
+   clock_gettime( CLOCK_MONOTONIC, &ts );
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// stores the message for lsort_error(), always returns -1
+static int fail( struct lsort* lsort, const char* format, ... )
+{
+   va_list ap;
+   va_start( ap, format );
+   vsnprintf( lsort->error, sizeof( lsort->error ), format, ap );
+   va_end( ap );
+   return -1;
+}
+
+#ifdef __linux__
+static int open_counter( struct lsort* lsort, int index, int exclude_kernel )
+{
+   static const struct
+   {
+      uint32_t type;
+      uint64_t config;
+   } events[ LSORT_COUNTERS ] = {
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_LL | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) },
+      { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | ( PERF_COUNT_HW_CACHE_OP_READ << 8 ) | ( PERF_COUNT_HW_CACHE_RESULT_MISS << 16 ) },
+      { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS }
+   };
+   struct perf_event_attr attr;
+   memset( &attr, 0, sizeof( attr ) );
+   attr.size = sizeof( attr );
+   attr.type = events[ index ].type;
+   attr.config = events[ index ].config;
+   attr.disabled = ( lsort->perf_group == -1 );
+   attr.exclude_kernel = exclude_kernel;
+   attr.exclude_hv = 1;
+   attr.read_format = PERF_FORMAT_GROUP;
+   return syscall( SYS_perf_event_open, &attr, 0, -1, lsort->perf_group, 0 );
+}
+
+// opens all counters that are available as one group for the calling thread,
+// including the kernel if the system allows it, so msync and page faults are visible
+static void open_counters( struct lsort* lsort )
+{
+   for( int exclude_kernel = 0; ( exclude_kernel != 2 ) && ( lsort->perf_group == -1 ); ++exclude_kernel ) {
+      for( int i = 0; i != LSORT_COUNTERS; ++i ) {
+         const int fd = open_counter( lsort, i, exclude_kernel );
+         if( fd < 0 ) {
+            lsort->perf_slot[ i ] = -1;
+            if( ( i == LSORT_COUNTER_CYCLES ) && ( exclude_kernel == 0 ) && ( ( errno == EACCES ) || ( errno == EPERM ) ) ) {
+               break;
+            }
+            continue;
+         }
+         if( lsort->perf_group == -1 ) {
+            lsort->perf_group = fd;
+         }
+         lsort->perf_slot[ i ] = lsort->perf_count++;
+      }
+      lsort->stats.counters_kernel = !exclude_kernel;
+   }
+   if( lsort->perf_group != -1 ) {
+      ioctl( lsort->perf_group, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP );
+   }
+}
+
+static void read_counters( struct lsort* lsort, uint64_t* values )
+{
+   uint64_t data[ 1 + LSORT_COUNTERS ];
+   if( read( lsort->perf_group, data, sizeof( data ) ) < (ssize_t)( ( 1 + lsort->perf_count ) * sizeof( uint64_t ) ) ) {
+      memset( data, 0, sizeof( data ) );
+   }
+   for( int i = 0; i != LSORT_COUNTERS; ++i ) {
+      values[ i ] = ( lsort->perf_slot[ i ] == -1 ) ? 0 : data[ 1 + lsort->perf_slot[ i ] ];
+   }
+}
+#else
+static void open_counters( struct lsort* lsort )
+{
+   (void)lsort;
+   errno = ENOSYS;
+}
+
+static void read_counters( struct lsort* lsort, uint64_t* values )
+{
+   (void)lsort;
+   memset( values, 0, LSORT_COUNTERS * sizeof( uint64_t ) );
+}
+#endif
+
+// the fields read by lsort_cancel() and lsort_progress() have a single writer,
+// relaxed loads and stores suffice
+static inline int cancelled( const struct lsort* lsort )
+{
+   return atomic_load_explicit( &lsort->cancelled, memory_order_relaxed );
+}
+
+static inline int phase( const struct lsort* lsort )
+{
+   return atomic_load_explicit( &lsort->phase, memory_order_relaxed );
+}
+
+// lines is the number of lines before the one at bytes, lines which are scanned
+// again after a forward move are not counted twice
+static inline void set_progress( struct lsort* lsort, size_t bytes, size_t lines )
+{
+   if( lines > lsort->stats.lines ) {
+      lsort->stats.lines = lines;
+   }
+   atomic_store_explicit( &lsort->progress_bytes, bytes, memory_order_relaxed );
+   atomic_store_explicit( &lsort->progress_lines, lsort->stats.lines, memory_order_relaxed );
+}
+
+static inline void count_move( struct lsort* lsort )
+{
+   atomic_store_explicit( &lsort->progress_moves, atomic_load_explicit( &lsort->progress_moves, memory_order_relaxed ) + 1, memory_order_relaxed );
+}
+
+// accounts the time and counters since the last call to the current phase
+static void enter( struct lsort* lsort, int next )
+{
+   if( lsort->options.stats ) {
+      const double t = lsort_now();
+      const int current = phase( lsort );
+      lsort->stats.time[ current ] += t - lsort->phase_start;
+      lsort->phase_start = t;
+      if( lsort->perf_group != -1 ) {
+         uint64_t values[ LSORT_COUNTERS ];
+         read_counters( lsort, values );
+         for( int i = 0; i != LSORT_COUNTERS; ++i ) {
+            lsort->stats.counters[ current ][ i ] += values[ i ] - lsort->perf_last[ i ];
+            lsort->perf_last[ i ] = values[ i ];
+         }
+      }
+   }
+   atomic_store_explicit( &lsort->phase, next, memory_order_relaxed );
+}
+
+static void sync_range( struct lsort* lsort, char* begin, size_t size )
+{
+   if( lsort->msync_mode == 0 ) {
+      return;
+   }
+   const int previous = phase( lsort );
+   enter( lsort, LSORT_PHASE_SYNC );
+   msync( begin, size, lsort->msync_mode );
+   ++lsort->stats.msync_calls;
+   lsort->stats.msync_bytes += size;
+   enter( lsort, previous );
+}
+
+// stops the running sort from within a comparison, run() then returns -1
+static int out_of_memory( struct lsort* lsort )
+{
+   if( !cancelled( lsort ) ) {
+      fail( lsort, "%s: Out of memory", lsort->name );
+      lsort->failed = 1;
+      atomic_store_explicit( &lsort->cancelled, 1, memory_order_relaxed );
+   }
+   return -1;
+}
+
+// makes room for n more bytes
+static int reserve( struct lsort* lsort, struct arena* arena, size_t n )
+{
+   if( arena->capacity - arena->size >= n ) {
+      return 0;
+   }
+   size_t capacity = ( arena->capacity == 0 ) ? 4096 : arena->capacity;
+   while( capacity - arena->size < n ) {
+      capacity *= 2;
+   }
+   char* tmp = (char*)realloc( arena->data, capacity );
+   if( tmp == NULL ) {
+      return out_of_memory( lsort );
+   }
+   arena->data = tmp;
+   arena->capacity = capacity;
+   return 0;
+}
+
+// the size of the delimiter that ends [begin, end) and, with crlf, a '\r' before it
+static inline size_t terminator_size( const struct lsort* lsort, const char* begin, const char* end )
+{
+   if( ( end == begin ) || ( *( end - 1 ) != lsort->options.delimiter ) ) {
+      return 0;
+   }
+   return ( lsort->crlf && ( end - begin >= 2 ) && ( *( end - 2 ) == '\r' ) ) ? 2 : 1;
+}
+
+// appends the key of the line [begin, end) to the arena
+static int extract( struct lsort* lsort, struct arena* arena, char* begin, char* end, struct key* key )
+{
+   end -= terminator_size( lsort, begin, end );
+   size_t size = end - begin;
+   if( lsort->options.max_compare != 0 ) {
+      size = zmin( size, lsort->options.max_compare );
+   }
+   if( reserve( lsort, arena, size ) != 0 ) {
+      return -1;
+   }
+   size_t available = arena->capacity - arena->size;
+   size_t required = lsort->options.extract( begin, size, arena->data + arena->size, available, lsort->options.extract_arg );
+   if( required > available ) {
+      if( reserve( lsort, arena, required ) != 0 ) {
+         return -1;
+      }
+      available = arena->capacity - arena->size;
+      required = zmin( lsort->options.extract( begin, size, arena->data + arena->size, available, lsort->options.extract_arg ), available );
+   }
+   key->offset = arena->size;
+   key->size = required;
+   arena->size += required;
+   return 0;
+}
+
+static inline unsigned char fold( unsigned char c )
+{
+   return ( (unsigned char)( c - 'a' ) < 26 ) ? ( c - 0x20 ) : c;
+}
+
+// like memcmp(), but lower case ASCII letters compare as upper case ones
+static int fallback_compare_folded( const char* lhs, const char* rhs, size_t n )
+{
+   for( size_t i = 0; i != n; ++i ) {
+      const int result = fold( lhs[ i ] ) - fold( rhs[ i ] );
+      if( result != 0 ) {
+         return result;
+      }
+   }
+   return 0;
+}
+
+#ifdef LSORT_X86
+static inline __m128i sse2_fold( __m128i v )
+{
+   // signed compares, bytes above 0x7f are never lower case
+   const __m128i lower = _mm_and_si128( _mm_cmpgt_epi8( v, _mm_set1_epi8( 'a' - 1 ) ), _mm_cmplt_epi8( v, _mm_set1_epi8( 'z' + 1 ) ) );
+   return _mm_sub_epi8( v, _mm_and_si128( lower, _mm_set1_epi8( 0x20 ) ) );
+}
+
+// the last block overlaps the one before when n is no multiple of the block
+// size, its bytes up to there are known to be equal
+static int sse2_compare_folded( const char* lhs, const char* rhs, size_t n )
+{
+   if( n < 16 ) {
+      return fallback_compare_folded( lhs, rhs, n );
+   }
+   for( size_t i = 0;; i = zmin( i + 16, n - 16 ) ) {
+      const __m128i l = _mm_loadu_si128( (const __m128i*)( lhs + i ) );
+      const __m128i r = _mm_loadu_si128( (const __m128i*)( rhs + i ) );
+      // equal blocks, as in long common prefixes, need no folding
+      if( _mm_movemask_epi8( _mm_cmpeq_epi8( l, r ) ) != 0xffff ) {
+         const unsigned mask = _mm_movemask_epi8( _mm_cmpeq_epi8( sse2_fold( l ), sse2_fold( r ) ) ) ^ 0xffff;
+         if( mask != 0 ) {
+            const size_t j = i + __builtin_ctz( mask );
+            return fold( lhs[ j ] ) - fold( rhs[ j ] );
+         }
+      }
+      if( i + 16 == n ) {
+         return 0;
+      }
+   }
+}
+
+__attribute__( ( target( "avx2" ) ) ) static inline __m256i avx2_fold( __m256i v )
+{
+   const __m256i lower = _mm256_and_si256( _mm256_cmpgt_epi8( v, _mm256_set1_epi8( 'a' - 1 ) ), _mm256_cmpgt_epi8( _mm256_set1_epi8( 'z' + 1 ), v ) );
+   return _mm256_sub_epi8( v, _mm256_and_si256( lower, _mm256_set1_epi8( 0x20 ) ) );
+}
+
+// never calls SSE code once the upper halves of the registers are in use
+__attribute__( ( target( "avx2" ) ) ) static int avx2_compare_folded( const char* lhs, const char* rhs, size_t n )
+{
+   if( n < 32 ) {
+      return sse2_compare_folded( lhs, rhs, n );
+   }
+   for( size_t i = 0;; i = zmin( i + 32, n - 32 ) ) {
+      const __m256i l = _mm256_loadu_si256( (const __m256i*)( lhs + i ) );
+      const __m256i r = _mm256_loadu_si256( (const __m256i*)( rhs + i ) );
+      if( ~(unsigned)_mm256_movemask_epi8( _mm256_cmpeq_epi8( l, r ) ) != 0 ) {
+         const unsigned mask = ~(unsigned)_mm256_movemask_epi8( _mm256_cmpeq_epi8( avx2_fold( l ), avx2_fold( r ) ) );
+         if( mask != 0 ) {
+            const size_t j = i + __builtin_ctz( mask );
+            return fold( lhs[ j ] ) - fold( rhs[ j ] );
+         }
+      }
+      if( i + 32 == n ) {
+         return 0;
+      }
+   }
+}
+#endif
+
+#ifdef LSORT_NEON
+static inline uint8x16_t neon_fold( uint8x16_t v )
+{
+   const uint8x16_t lower = vandq_u8( vcgeq_u8( v, vdupq_n_u8( 'a' ) ), vcleq_u8( v, vdupq_n_u8( 'z' ) ) );
+   return vsubq_u8( v, vandq_u8( lower, vdupq_n_u8( 0x20 ) ) );
+}
+
+static int neon_compare_folded( const char* lhs, const char* rhs, size_t n )
+{
+   if( n < 16 ) {
+      return fallback_compare_folded( lhs, rhs, n );
+   }
+   for( size_t i = 0;; i = zmin( i + 16, n - 16 ) ) {
+      const uint8x16_t l = vld1q_u8( (const uint8_t*)( lhs + i ) );
+      const uint8x16_t r = vld1q_u8( (const uint8_t*)( rhs + i ) );
+      if( vminvq_u8( vceqq_u8( l, r ) ) == 0 ) {
+         // four bits per byte
+         const uint64_t mask = ~vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( vreinterpretq_u16_u8( vceqq_u8( neon_fold( l ), neon_fold( r ) ) ), 4 ) ), 0 );
+         if( mask != 0 ) {
+            const size_t j = i + __builtin_ctzll( mask ) / 4;
+            return fold( lhs[ j ] ) - fold( rhs[ j ] );
+         }
+      }
+      if( i + 16 == n ) {
+         return 0;
+      }
+   }
+}
+#endif
+
+// selected on first use like memrchr_impl below, with relaxed atomics as
+// contexts on different threads may select it at the same time
+static int ( *_Atomic compare_folded_impl )( const char*, const char*, size_t ) = NULL;
+
+static int compare_folded( const char* lhs, const char* rhs, size_t n )
+{
+   int ( *impl )( const char*, const char*, size_t ) = atomic_load_explicit( &compare_folded_impl, memory_order_relaxed );
+   if( impl == NULL ) {
+#if defined( LSORT_X86 )
+      __builtin_cpu_init();
+      impl = __builtin_cpu_supports( "avx2" ) ? avx2_compare_folded : sse2_compare_folded;
+#elif defined( LSORT_NEON )
+      impl = neon_compare_folded;
+#else
+      impl = fallback_compare_folded;
+#endif
+      atomic_store_explicit( &compare_folded_impl, impl, memory_order_relaxed );
+   }
+   return impl( lhs, rhs, n );
+}
+
+// lhs <= rhs for keys or lines without their trailing newline; equal keys
+// are <= in both orders, so with reverse equal lines keep their order and are
+// not moved past each other
+static inline int le_keys( struct lsort* lsort, const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size )
+{
+   int result;
+   if( lsort->options.compare != NULL ) {
+      result = lsort->options.compare( lhs, lhs_size, rhs, rhs_size, lsort->options.compare_arg );
+   }
+   else if( lsort->options.fold ) {
+      result = compare_folded( lhs, rhs, zmin( lhs_size, rhs_size ) );
+      if( result == 0 ) {
+         result = ( lhs_size > rhs_size ) - ( lhs_size < rhs_size );
+      }
+   }
+   else {
+      result = memcmp( lhs, rhs, zmin( lhs_size, rhs_size ) );
+      if( result == 0 ) {
+         result = ( lhs_size > rhs_size ) - ( lhs_size < rhs_size );
+      }
+   }
+   return ( result == 0 ) || ( ( result < 0 ) != lsort->options.reverse );
+}
+
+// lhs <= rhs by their keys, lhs_key and rhs_key are cached keys or NULL
+static int le_extracted( struct lsort* lsort, const struct key* lhs_key, char* lhs_begin, char* lhs_end, const struct key* rhs_key, char* rhs_begin, char* rhs_end )
+{
+   struct key lhs;
+   struct key rhs;
+   const char* lhs_data = lsort->arena.data;
+   const char* rhs_data = lsort->arena.data;
+   if( lhs_key == NULL ) {
+      lsort->scratch[ 0 ].size = 0;
+      if( extract( lsort, &lsort->scratch[ 0 ], lhs_begin, lhs_end, &lhs ) != 0 ) {
+         return 1;
+      }
+      lhs_key = &lhs;
+      lhs_data = lsort->scratch[ 0 ].data;
+   }
+   if( rhs_key == NULL ) {
+      lsort->scratch[ 1 ].size = 0;
+      if( extract( lsort, &lsort->scratch[ 1 ], rhs_begin, rhs_end, &rhs ) != 0 ) {
+         return 1;
+      }
+      rhs_key = &rhs;
+      rhs_data = lsort->scratch[ 1 ].data;
+   }
+   return le_keys( lsort, lhs_data + lhs_key->offset, lhs_key->size, rhs_data + rhs_key->offset, rhs_key->size );
+}
+
+// lhs <= rhs for whole lines
+static inline int le_lines( struct lsort* lsort, char* lhs_begin, char* lhs_end, char* rhs_begin, char* rhs_end )
+{
+   lhs_end -= terminator_size( lsort, lhs_begin, lhs_end );
+   rhs_end -= terminator_size( lsort, rhs_begin, rhs_end );
+   size_t lhs_size = lhs_end - lhs_begin;
+   size_t rhs_size = rhs_end - rhs_begin;
+   if( lsort->options.max_compare != 0 ) {
+      lhs_size = zmin( lhs_size, lsort->options.max_compare );
+      rhs_size = zmin( rhs_size, lsort->options.max_compare );
+   }
+   return le_keys( lsort, lhs_begin, lhs_size, rhs_begin, rhs_size );
+}
+
+// lhs <= rhs
+static inline int le( struct lsort* lsort, char* lhs_begin, char* lhs_end, char* rhs_begin, char* rhs_end )
+{
+   ++lsort->stats.comparisons;
+   if( lsort->options.extract != NULL ) {
+      return le_extracted( lsort, NULL, lhs_begin, lhs_end, NULL, rhs_begin, rhs_end );
+   }
+   return le_lines( lsort, lhs_begin, lhs_end, rhs_begin, rhs_end );
+}
+
+int lsort_le( struct lsort* lsort, char* lhs_begin, char* lhs_end, char* rhs_begin, char* rhs_end )
+{
+   return le( lsort, lhs_begin, lhs_end, rhs_begin, rhs_end );
+}
+
+// byte-at-a-time memrchr, used for the tails of the faster versions below
+static void* fallback_memrchr( const void* s, int c, size_t n )
+{
+   if( n != 0 ) {
+      const unsigned char* cp = (const unsigned char*)s + n;
+      do {
+         if( *( --cp ) == (unsigned char)c )
+            return (void*)cp;
+      } while( --n != 0 );
+   }
+   return NULL;
+}
+
+#if !defined( LSORT_X86 ) && !defined( LSORT_NEON )
+// tests a word at a time, for targets without a vectorized version
+static void* word_memrchr( const void* s, int c, size_t n )
+{
+   const size_t ones = (size_t)-1 / 255;
+   const size_t pattern = ones * (unsigned char)c;
+   const unsigned char* cp = (const unsigned char*)s + n;
+   while( n >= sizeof( size_t ) ) {
+      cp -= sizeof( size_t );
+      n -= sizeof( size_t );
+      size_t word;
+      memcpy( &word, cp, sizeof( word ) );
+      word ^= pattern;
+      if( ( ( word - ones ) & ~word & ( ones << 7 ) ) != 0 ) {
+         for( size_t i = sizeof( size_t ); i != 0; --i ) {
+            if( cp[ i - 1 ] == (unsigned char)c ) {
+               return (void*)( cp + i - 1 );
+            }
+         }
+      }
+   }
+   return fallback_memrchr( s, c, n );
+}
+#endif
+
+#ifdef LSORT_X86
+static void* sse2_memrchr( const void* s, int c, size_t n )
+{
+   const __m128i needle = _mm_set1_epi8( (char)c );
+   const unsigned char* cp = (const unsigned char*)s + n;
+   while( n >= 16 ) {
+      cp -= 16;
+      n -= 16;
+      const unsigned mask = _mm_movemask_epi8( _mm_cmpeq_epi8( _mm_loadu_si128( (const __m128i*)cp ), needle ) );
+      if( mask != 0 ) {
+         return (void*)( cp + 31 - __builtin_clz( mask ) );
+      }
+   }
+   return fallback_memrchr( s, c, n );
+}
+
+__attribute__( ( target( "avx2" ) ) ) static void* avx2_memrchr( const void* s, int c, size_t n )
+{
+   const __m256i needle = _mm256_set1_epi8( (char)c );
+   const unsigned char* cp = (const unsigned char*)s + n;
+   while( n >= 64 ) {
+      cp -= 64;
+      n -= 64;
+      const __m256i hi = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)( cp + 32 ) ), needle );
+      const __m256i lo = _mm256_cmpeq_epi8( _mm256_loadu_si256( (const __m256i*)cp ), needle );
+      if( !_mm256_testz_si256( _mm256_or_si256( hi, lo ), _mm256_or_si256( hi, lo ) ) ) {
+         const unsigned mask = _mm256_movemask_epi8( hi );
+         if( mask != 0 ) {
+            return (void*)( cp + 63 - __builtin_clz( mask ) );
+         }
+         return (void*)( cp + 31 - __builtin_clz( (unsigned)_mm256_movemask_epi8( lo ) ) );
+      }
+   }
+   return sse2_memrchr( s, c, n );
+}
+#endif
+
+#ifdef LSORT_NEON
+static void* neon_memrchr( const void* s, int c, size_t n )
+{
+   const uint8x16_t needle = vdupq_n_u8( (uint8_t)c );
+   const unsigned char* cp = (const unsigned char*)s + n;
+   while( n >= 16 ) {
+      cp -= 16;
+      n -= 16;
+      const uint8x16_t eq = vceqq_u8( vld1q_u8( cp ), needle );
+      // four bits per byte
+      const uint64_t mask = vget_lane_u64( vreinterpret_u64_u8( vshrn_n_u16( vreinterpretq_u16_u8( eq ), 4 ) ), 0 );
+      if( mask != 0 ) {
+         return (void*)( cp + ( 63 - __builtin_clzll( mask ) ) / 4 );
+      }
+   }
+   return fallback_memrchr( s, c, n );
+}
+#endif
+
+// selected on first use, musl has no ifunc support; threads of different
+// contexts may select it at the same time, they all store the same pointer
+static void* ( *_Atomic memrchr_impl )( const void*, int, size_t ) = NULL;
+
+static void* select_memrchr( const void* s, int c, size_t n )
+{
+   void* ( *impl )( const void*, int, size_t );
+#if defined( LSORT_X86 )
+   __builtin_cpu_init();
+   impl = __builtin_cpu_supports( "avx2" ) ? avx2_memrchr : sse2_memrchr;
+#elif defined( LSORT_NEON )
+   impl = neon_memrchr;
+#else
+   impl = word_memrchr;
+#endif
+   atomic_store_explicit( &memrchr_impl, impl, memory_order_relaxed );
+   return impl( s, c, n );
+}
+
+// unused where glibc's memrchr() is, but bench/micro compares the two
+__attribute__( ( unused ) ) static void* vector_memrchr( const void* s, int c, size_t n )
+{
+   void* ( *impl )( const void*, int, size_t ) = atomic_load_explicit( &memrchr_impl, memory_order_relaxed );
+   if( impl == NULL ) {
+      return select_memrchr( s, c, n );
+   }
+   return impl( s, c, n );
+}
+
+// glibc's memrchr() is declared with _GNU_SOURCE, which the Makefile defines
+#if !defined( _GNU_SOURCE ) || !defined( __GLIBC__ )
+#define memrchr vector_memrchr
+#endif
+
+static inline char* find( char* pos, char* end, char delimiter )
+{
+   char* result = (char*)memchr( pos, delimiter, end - pos );
+   if( result != NULL ) {
+      return ++result;
+   }
+   return end;
+}
+
+static inline char* rfind( char* data, char* prev, char delimiter )
+{
+   char* result = (char*)memrchr( data, delimiter, prev - data - 1 );
+   if( result != NULL ) {
+      return ++result;
+   }
+   return data;
+}
+
+// whether the line at pos belongs to the line before it
+static int is_continuation( const struct lsort* lsort, const char* pos, const char* end )
+{
+   if( lsort->record_start != NULL ) {
+      const size_t size = lsort->record_start_size;
+      return ( (size_t)( end - pos ) < size ) || ( memcmp( pos, lsort->record_start, size ) != 0 );
+   }
+   return ( pos != end ) && ( ( *pos == ' ' ) || ( *pos == '\t' ) );
+}
+
+// like find(), but with multiline, continuation lines are part of the line
+static inline char* find_line( const struct lsort* lsort, char* pos, char* end )
+{
+   pos = find( pos, end, lsort->options.delimiter );
+   if( lsort->options.multiline ) {
+      while( ( pos != end ) && is_continuation( lsort, pos, end ) ) {
+         pos = find( pos, end, lsort->options.delimiter );
+      }
+   }
+   return pos;
+}
+
+// the beginning of the line which contains the line at pos
+static inline char* line_begin( const struct lsort* lsort, char* data, char* pos, char* end )
+{
+   if( lsort->options.multiline ) {
+      while( ( pos != data ) && is_continuation( lsort, pos, end ) ) {
+         pos = rfind( data, pos, lsort->options.delimiter );
+      }
+   }
+   return pos;
+}
+
+// like rfind(), but with multiline, continuation lines are part of the line
+static inline char* rfind_line( const struct lsort* lsort, char* data, char* prev )
+{
+   return line_begin( lsort, data, rfind( data, prev, lsort->options.delimiter ), prev );
+}
+
+char* lsort_find( struct lsort* lsort, char* pos, char* end )
+{
+   return find_line( lsort, pos, end );
+}
+
+char* lsort_rfind( struct lsort* lsort, char* data, char* prev )
+{
+   return rfind_line( lsort, data, prev );
+}
+
+struct source
+{
+   char* begin;
+   char* end;
+   FILE* file;
+   char* buffer;
+   size_t capacity;
+   // with multiline, the line read after the current one, size -1 at the end of file
+   char* ahead;
+   size_t ahead_capacity;
+   ssize_t ahead_size;
+};
+
+struct keyed_line
+{
+   struct line line;
+   struct key key;
+};
+
+// descending order, equal lines by descending position
+static int compare_descending( const void* lhs, const void* rhs )
+{
+   const struct line* l = (const struct line*)lhs;
+   const struct line* r = (const struct line*)rhs;
+   if( l->begin == r->begin ) {
+      return 0;
+   }
+   if( !le( sorting, l->begin, l->end, r->begin, r->end ) ) {
+      return -1;
+   }
+   if( !le( sorting, r->begin, r->end, l->begin, l->end ) ) {
+      return 1;
+   }
+   return ( l->begin > r->begin ) ? -1 : 1;
+}
+
+// ascending order, equal lines by ascending position
+static int compare_ascending( const void* lhs, const void* rhs )
+{
+   return compare_descending( rhs, lhs );
+}
+
+// like compare_descending(), but for lines with extracted keys
+static int compare_keyed_descending( const void* lhs, const void* rhs )
+{
+   const struct keyed_line* l = (const struct keyed_line*)lhs;
+   const struct keyed_line* r = (const struct keyed_line*)rhs;
+   if( l->line.begin == r->line.begin ) {
+      return 0;
+   }
+   const char* keys = sorting->arena.data;
+   ++sorting->stats.comparisons;
+   if( !le_keys( sorting, keys + l->key.offset, l->key.size, keys + r->key.offset, r->key.size ) ) {
+      return -1;
+   }
+   ++sorting->stats.comparisons;
+   if( !le_keys( sorting, keys + r->key.offset, r->key.size, keys + l->key.offset, l->key.size ) ) {
+      return 1;
+   }
+   return ( l->line.begin > r->line.begin ) ? -1 : 1;
+}
+
+static int compare_keyed_ascending( const void* lhs, const void* rhs )
+{
+   return compare_keyed_descending( rhs, lhs );
+}
+
+// sorts with qsort(), extracting each key only once
+static int sort_lines( struct lsort* lsort, struct line* lines, size_t size, int descending )
+{
+   struct lsort* const previous = sorting;
+   sorting = lsort;
+   if( lsort->options.extract == NULL ) {
+      qsort( lines, size, sizeof( struct line ), descending ? compare_descending : compare_ascending );
+      sorting = previous;
+      return 0;
+   }
+
+   struct keyed_line* keyed = (struct keyed_line*)malloc( size * sizeof( struct keyed_line ) );
+   if( keyed == NULL ) {
+      sorting = previous;
+      return -1;
+   }
+   lsort->arena.size = 0;
+   for( size_t i = 0; i != size; ++i ) {
+      keyed[ i ].line = lines[ i ];
+      if( extract( lsort, &lsort->arena, lines[ i ].begin, lines[ i ].end, &keyed[ i ].key ) != 0 ) {
+         free( keyed );
+         sorting = previous;
+         return -1;
+      }
+   }
+   qsort( keyed, size, sizeof( struct keyed_line ), descending ? compare_keyed_descending : compare_keyed_ascending );
+   for( size_t i = 0; i != size; ++i ) {
+      lines[ i ] = keyed[ i ].line;
+   }
+   free( keyed );
+   sorting = previous;
+   return 0;
+}
+
+static FILE* create_temporary( void )
+{
+   const char* dir = getenv( "TMPDIR" );
+   if( ( dir == NULL ) || ( *dir == '\0' ) ) {
+      dir = "/tmp";
+   }
+   const size_t size = strlen( dir ) + 14;
+   char* name = (char*)malloc( size );
+   if( name == NULL ) {
+      return NULL;
+   }
+   snprintf( name, size, "%s/lsort.XXXXXX", dir );
+   const int fd = mkstemp( name );
+   if( fd < 0 ) {
+      free( name );
+      return NULL;
+   }
+   unlink( name );
+   free( name );
+   FILE* result = fdopen( fd, "w+" );
+   if( result == NULL ) {
+      close( fd );
+   }
+   return result;
+}
+
+// the source with the larger line wins, equal lines are won by the later source
+static int beats( struct lsort* lsort, struct source* sources, size_t n, size_t a, size_t b )
+{
+   if( a == n ) {
+      return 1;
+   }
+   if( b == n ) {
+      return 0;
+   }
+   if( sources[ a ].begin == NULL ) {
+      return 0;
+   }
+   if( sources[ b ].begin == NULL ) {
+      return 1;
+   }
+   if( a < b ) {
+      return !le( lsort, sources[ a ].begin, sources[ a ].end, sources[ b ].begin, sources[ b ].end );
+   }
+   return le( lsort, sources[ b ].begin, sources[ b ].end, sources[ a ].begin, sources[ a ].end );
+}
+
+static void adjust( struct lsort* lsort, size_t* tree, struct source* sources, size_t n, size_t s )
+{
+   for( size_t t = ( s + n ) / 2; t > 0; t /= 2 ) {
+      if( beats( lsort, sources, n, tree[ t ], s ) ) {
+         const size_t tmp = tree[ t ];
+         tree[ t ] = s;
+         s = tmp;
+      }
+   }
+   tree[ 0 ] = s;
+}
+
+// with multiline, the continuation lines are read ahead until the next line begins
+static int advance_lines( struct lsort* lsort, struct source* source )
+{
+   const char delimiter = lsort->options.delimiter;
+   if( source->ahead_size == 0 ) {
+      source->ahead_size = getdelim( &source->ahead, &source->ahead_capacity, delimiter, source->file );
+   }
+   size_t size = 0;
+   while( source->ahead_size > 0 ) {
+      if( ( size != 0 ) && !is_continuation( lsort, source->ahead, source->ahead + source->ahead_size ) ) {
+         break;
+      }
+      if( size + source->ahead_size > source->capacity ) {
+         const size_t capacity = 2 * ( size + source->ahead_size );
+         char* tmp = (char*)realloc( source->buffer, capacity );
+         if( tmp == NULL ) {
+            return -1;
+         }
+         source->buffer = tmp;
+         source->capacity = capacity;
+      }
+      memcpy( source->buffer + size, source->ahead, source->ahead_size );
+      size += source->ahead_size;
+      source->ahead_size = getdelim( &source->ahead, &source->ahead_capacity, delimiter, source->file );
+   }
+   if( size == 0 ) {
+      source->begin = NULL;
+      return ferror( source->file ) ? -1 : 0;
+   }
+   source->begin = source->buffer;
+   source->end = source->buffer + size;
+   return 0;
+}
+
+static int advance( struct lsort* lsort, struct source* source, char* begin )
+{
+   if( source->file == NULL ) {
+      if( source->begin == begin ) {
+         source->begin = NULL;
+      }
+      else {
+         source->end = source->begin;
+         source->begin = rfind_line( lsort, begin, source->begin );
+      }
+      return 0;
+   }
+   if( lsort->options.multiline ) {
+      return advance_lines( lsort, source );
+   }
+   const ssize_t size = getdelim( &source->buffer, &source->capacity, lsort->options.delimiter, source->file );
+   if( size < 0 ) {
+      source->begin = NULL;
+      return ferror( source->file ) ? -1 : 0;
+   }
+   source->begin = source->buffer;
+   source->end = source->buffer + size;
+   return 0;
+}
+
+// sorts [current, end) and merges it into the sorted lines [data, current)
+static int external_sort( struct lsort* lsort, char* data, char* current, char* end )
+{
+   int result = -1;
+   size_t count = 1;
+   struct source* sources = (struct source*)calloc( count, sizeof( struct source ) );
+   struct line* lines = NULL;
+   size_t* tree = NULL;
+   if( sources == NULL ) {
+      goto out_of_memory;
+   }
+
+   // write the unsorted lines in sorted runs, largest line first
+   struct line min = { NULL, NULL };
+   size_t lacking = 0;       // the run with the line that ended the data without a delimiter
+   size_t lacking_rank = 0;  // and the number of lines before it in that run
+   char* pos = current;
+   while( pos != end ) {
+      size_t used = 0;
+      size_t size = 0;
+      size_t capacity = 0;
+      while( ( pos != end ) && ( ( size == 0 ) || ( used < lsort->options.buffer_size ) ) ) {
+         if( size == capacity ) {
+            capacity = ( capacity == 0 ) ? 4096 : ( capacity * 2 );
+            struct line* tmp = (struct line*)realloc( lines, capacity * sizeof( struct line ) );
+            if( tmp == NULL ) {
+               goto out_of_memory;
+            }
+            lines = tmp;
+         }
+         lines[ size ].begin = pos;
+         lines[ size ].end = pos = find_line( lsort, pos, end );
+         used += ( pos - lines[ size ].begin ) + sizeof( struct line );
+         ++size;
+         set_progress( lsort, pos - data, lsort->stats.lines + 1 );
+      }
+      if( sort_lines( lsort, lines, size, 1 ) != 0 ) {
+         goto out_of_memory;
+      }
+
+      struct source* tmp = (struct source*)realloc( sources, ( count + 1 ) * sizeof( struct source ) );
+      if( tmp == NULL ) {
+         goto out_of_memory;
+      }
+      sources = tmp;
+      memset( &sources[ count ], 0, sizeof( struct source ) );
+      FILE* file = sources[ count++ ].file = create_temporary();
+      if( file == NULL ) {
+         goto io_error;
+      }
+      for( size_t i = 0; i != size; ++i ) {
+         fwrite( lines[ i ].begin, 1, lines[ i ].end - lines[ i ].begin, file );
+         if( *( lines[ i ].end - 1 ) != lsort->options.delimiter ) {
+            fputc( lsort->options.delimiter, file );
+            lacking = count - 1;
+            lacking_rank = i;
+         }
+      }
+      if( ( fflush( file ) != 0 ) || ( fseek( file, 0, SEEK_SET ) != 0 ) ) {
+         goto io_error;
+      }
+      if( ( min.begin == NULL ) || !le( lsort, min.begin, min.end, lines[ size - 1 ].begin, lines[ size - 1 ].end ) ) {
+         min = lines[ size - 1 ];
+      }
+   }
+   free( lines );
+   lines = NULL;
+
+   // lines of [data, current) which are not larger than the smallest unsorted line stay in place
+   char* lo = data;
+   char* hi = current;
+   while( lo < hi ) {
+      char* mid = (char*)memrchr( lo, lsort->options.delimiter, ( hi - lo ) / 2 );
+      mid = line_begin( lsort, lo, ( mid != NULL ) ? ( mid + 1 ) : lo, current );
+      char* mid_end = find_line( lsort, mid, current );
+      if( le( lsort, mid, mid_end, min.begin, min.end ) ) {
+         lo = mid_end;
+      }
+      else {
+         hi = mid;
+      }
+   }
+
+   // merge backwards, the write position never overtakes the unmerged sorted lines
+   sources[ 0 ].begin = sources[ 0 ].end = current;
+   for( size_t i = 0; i != count; ++i ) {
+      if( advance( lsort, &sources[ i ], lo ) != 0 ) {
+         goto io_error;
+      }
+   }
+   tree = (size_t*)malloc( count * sizeof( size_t ) );
+   if( tree == NULL ) {
+      goto out_of_memory;
+   }
+   for( size_t i = 0; i != count; ++i ) {
+      tree[ i ] = count;
+   }
+   for( size_t i = count; i != 0; --i ) {
+      adjust( lsort, tree, sources, count, i - 1 );
+   }
+
+   // the delimiter added to the line that ended the data is replaced by the
+   // one (with crlf, maybe "\r\n") which the line that ends it now gives up
+   size_t runs = count - 1;
+   int newline = ( *( end - 1 ) == lsort->options.delimiter );
+   char terminator[ 2 ];
+   size_t missing = 0;
+   char* write = end;
+   while( runs != 0 ) {
+      const size_t s = tree[ 0 ];
+      struct source* source = &sources[ s ];
+      size_t size = source->end - source->begin;
+      int added = 0;
+      if( ( lacking != 0 ) && ( s == lacking ) ) {
+         added = ( lacking_rank == 0 );
+         lacking = added ? 0 : lacking;
+         --lacking_rank;
+      }
+      size_t extra = 0;
+      if( !newline ) {
+         missing = added ? 1 : terminator_size( lsort, source->begin, source->end );
+         size -= missing;
+         memcpy( terminator, source->begin + size, missing );
+         newline = 1;
+      }
+      else if( added ) {
+         --size;
+         extra = missing;
+      }
+      write -= size + extra;
+      memmove( write, source->begin, size );
+      memcpy( write + size, terminator, extra );
+      lsort->stats.bytes_moved += size + extra;
+      if( advance( lsort, source, lo ) != 0 ) {
+         goto io_error;
+      }
+      if( ( s != 0 ) && ( source->begin == NULL ) ) {
+         --runs;
+      }
+      adjust( lsort, tree, sources, count, s );
+   }
+
+   sync_range( lsort, lo, end - lo );
+   result = 0;
+   goto cleanup;
+
+io_error:
+   fail( lsort, "%s: Temporary file: %s", lsort->name, strerror( errno ) );
+   goto cleanup;
+
+out_of_memory:
+   fail( lsort, "%s: Out of memory", lsort->name );
+
+cleanup:
+   free( tree );
+   free( lines );
+   for( size_t i = 1; i < count; ++i ) {
+      if( sources[ i ].file != NULL ) {
+         fclose( sources[ i ].file );
+      }
+      free( sources[ i ].buffer );
+      free( sources[ i ].ahead );
+   }
+   free( sources );
+   return result;
+}
+
+// moves late lines aside, compacts the remaining lines and merges the late lines back
+static int merge_late( struct lsort* lsort, char* data, char* end )
+{
+   char* late = NULL;
+   size_t late_size = 0;
+   size_t late_capacity = 0;
+   size_t* offsets = NULL;
+   size_t count = 0;
+   size_t capacity = 0;
+   struct line* lines = NULL;
+
+   char* write = data;
+   char* first = NULL;
+   char* max_begin = NULL;
+   char* max_end = NULL;
+   char* pos = data;
+   while( pos != end ) {
+      char* next = find_line( lsort, pos, end );
+      const size_t size = next - pos;
+      if( ( max_begin == NULL ) || le( lsort, max_begin, max_end, pos, next ) ) {
+         if( write != pos ) {
+            memmove( write, pos, size );
+            lsort->stats.bytes_moved += size;
+         }
+         max_begin = write;
+         max_end = write += size;
+      }
+      else {
+         if( cancelled( lsort ) || ( late_size + size + 1 + ( count + 1 ) * sizeof( size_t ) > lsort->options.buffer_size ) ) {
+            break;
+         }
+         if( late_size + size + 1 > late_capacity ) {
+            late_capacity = ( late_size + size + 1 ) * 2;
+            char* tmp = (char*)realloc( late, late_capacity );
+            if( tmp == NULL ) {
+               break;
+            }
+            late = tmp;
+         }
+         if( count + 1 >= capacity ) {
+            capacity = ( capacity == 0 ) ? 4096 : ( capacity * 2 );
+            size_t* tmp = (size_t*)realloc( offsets, capacity * sizeof( size_t ) );
+            if( tmp == NULL ) {
+               break;
+            }
+            offsets = tmp;
+         }
+         if( first == NULL ) {
+            first = write;
+         }
+         offsets[ count++ ] = late_size;
+         memcpy( late + late_size, pos, size );
+         late_size += size;
+      }
+      pos = next;
+      set_progress( lsort, pos - data, lsort->stats.lines + 1 );
+   }
+
+   if( pos != end ) {
+      // out of budget or interrupted, restore the late lines and let the external sort handle the rest
+      if( late_size != 0 ) {
+         memcpy( write, late, late_size );
+      }
+      free( late );
+      free( offsets );
+      if( cancelled( lsort ) ) {
+         return 0;
+      }
+      if( lsort->options.log != NULL ) {
+         fprintf( lsort->options.log, "%s: late lines exceed --buffer-size, using external merge sort\n", lsort->name );
+      }
+      // the external sort counts the restored late lines again
+      lsort->stats.lines -= count;
+      return external_sort( lsort, data, write, end );
+   }
+
+   if( count != 0 ) {
+      lines = (struct line*)malloc( count * sizeof( struct line ) );
+      if( lines == NULL ) {
+         memcpy( write, late, late_size );
+         free( late );
+         free( offsets );
+         return fail( lsort, "%s: Out of memory", lsort->name );
+      }
+      offsets[ count ] = late_size;
+      for( size_t i = 0; i != count; ++i ) {
+         lines[ i ].begin = late + offsets[ i ];
+         lines[ i ].end = late + offsets[ i + 1 ];
+      }
+      if( sort_lines( lsort, lines, count, 0 ) != 0 ) {
+         memcpy( write, late, late_size );
+         free( lines );
+         free( late );
+         free( offsets );
+         return fail( lsort, "%s: Out of memory", lsort->name );
+      }
+
+      // merge backwards, equal late lines go after the compacted lines: a kept
+      // line that is equal to a late one cannot come after it, as it would be
+      // less than the maximum the late line was compared with, so the order of
+      // equal lines is kept like with the insertion engine; if the data does not
+      // end with a delimiter, the line that is now the last one gives its
+      // delimiter to the one that was
+      int newline = ( *( end - 1 ) == lsort->options.delimiter );
+      char terminator[ 2 ];
+      size_t missing = 0;
+      char* out = end;
+      char* kept_end = write;
+      char* kept_begin = ( write != data ) ? rfind_line( lsort, data, write ) : NULL;
+      for( size_t i = count; i != 0; ) {
+         char* begin;
+         size_t size;
+         if( ( kept_begin != NULL ) && !le( lsort, kept_begin, kept_end, lines[ i - 1 ].begin, lines[ i - 1 ].end ) ) {
+            begin = kept_begin;
+            size = kept_end - kept_begin;
+            kept_end = kept_begin;
+            kept_begin = ( kept_end != data ) ? rfind_line( lsort, data, kept_end ) : NULL;
+         }
+         else {
+            --i;
+            begin = lines[ i ].begin;
+            size = lines[ i ].end - lines[ i ].begin;
+         }
+         size_t extra = 0;
+         if( !newline ) {
+            missing = terminator_size( lsort, begin, begin + size );
+            size -= missing;
+            memcpy( terminator, begin + size, missing );
+            newline = 1;
+         }
+         else if( begin[ size - 1 ] != lsort->options.delimiter ) {
+            extra = missing;
+         }
+         out -= size + extra;
+         memmove( out, begin, size );
+         memcpy( out + size, terminator, extra );
+         lsort->stats.bytes_moved += size + extra;
+      }
+      sync_range( lsort, first, end - first );
+   }
+
+   free( lines );
+   free( late );
+   free( offsets );
+   return 0;
+}
+
+// sorts blocks of lines in memory, the insertion pass then fixes lines across block boundaries
+static int sort_blocks( struct lsort* lsort, char* data, char* end )
+{
+   struct line* lines = NULL;
+   size_t capacity = 0;
+   char* copy = NULL;
+   size_t copy_size = 0;
+
+   char* pos = data;
+   while( !cancelled( lsort ) && ( pos != end ) ) {
+      char* const begin = pos;
+      size_t used = 0;
+      size_t size = 0;
+      int sorted = 1;
+      while( ( pos != end ) && ( ( size == 0 ) || ( used < lsort->options.buffer_size / 2 ) ) ) {
+         if( size == capacity ) {
+            capacity = ( capacity == 0 ) ? 4096 : ( capacity * 2 );
+            struct line* tmp = (struct line*)realloc( lines, capacity * sizeof( struct line ) );
+            if( tmp == NULL ) {
+               goto out_of_memory;
+            }
+            lines = tmp;
+         }
+         lines[ size ].begin = pos;
+         lines[ size ].end = pos = find_line( lsort, pos, end );
+         if( ( size != 0 ) && sorted ) {
+            sorted = le( lsort, lines[ size - 1 ].begin, lines[ size - 1 ].end, lines[ size ].begin, lines[ size ].end );
+         }
+         used += ( pos - lines[ size ].begin ) + sizeof( struct line );
+         ++size;
+      }
+      if( sorted ) {
+         continue;
+      }
+      if( sort_lines( lsort, lines, size, 0 ) != 0 ) {
+         goto out_of_memory;
+      }
+
+      const size_t block_size = pos - begin;
+      if( copy_size < block_size + 2 ) {
+         free( copy );
+         copy_size = block_size + 2;
+         copy = (char*)malloc( copy_size );
+         if( copy == NULL ) {
+            goto out_of_memory;
+         }
+      }
+      // the line that ended the data without a delimiter takes the one of
+      // the line that ends it now, which is cut off
+      char* const last = lines[ size - 1 ].begin;
+      const size_t missing = terminator_size( lsort, last, lines[ size - 1 ].end );
+      char* write = copy;
+      for( size_t i = 0; i != size; ++i ) {
+         const size_t line_size = lines[ i ].end - lines[ i ].begin;
+         memcpy( write, lines[ i ].begin, line_size );
+         write += line_size;
+         if( *( write - 1 ) != lsort->options.delimiter ) {
+            memcpy( write, lines[ size - 1 ].end - missing, missing );
+            write += missing;
+         }
+      }
+      memcpy( begin, copy, block_size );
+      lsort->stats.bytes_moved += block_size;
+      sync_range( lsort, begin, block_size );
+   }
+
+   free( copy );
+   free( lines );
+   return 0;
+
+out_of_memory:
+   free( copy );
+   free( lines );
+   return fail( lsort, "%s: Out of memory", lsort->name );
+}
+
+#define SAMPLES 64
+#define WINDOW 256
+
+// samples windows of lines to estimate the disorder and choose an engine;
+// windows do not overlap, so small inputs are sampled once as a whole
+static int select_engine( struct lsort* lsort, char* data, char* end )
+{
+   struct line window[ WINDOW ];
+   size_t lines = 0;
+   size_t sampled = 0;
+   size_t inversions = 0;
+   size_t late = 0;
+   size_t far = 0;
+   size_t displacement = 0;
+
+   const size_t step = ( end - data ) / SAMPLES;
+   char* sampled_end = data;
+   for( size_t i = 0; ( i != SAMPLES ) && ( sampled_end != end ); ++i ) {
+      char* pos = data + i * step;
+      if( pos != data ) {
+         pos = find_line( lsort, pos - 1, end );
+      }
+      if( pos < sampled_end ) {
+         pos = sampled_end;
+      }
+      size_t size = 0;
+      while( ( size != WINDOW ) && ( pos != end ) ) {
+         window[ size ].begin = pos;
+         window[ size ].end = pos = find_line( lsort, pos, end );
+         ++size;
+      }
+      if( size == 0 ) {
+         break;
+      }
+      sampled_end = pos;
+      sampled += pos - window[ 0 ].begin;
+      size_t max = 0;
+      for( size_t j = 1; j < size; ++j ) {
+         ++lines;
+         if( !le( lsort, window[ j - 1 ].begin, window[ j - 1 ].end, window[ j ].begin, window[ j ].end ) ) {
+            ++inversions;
+         }
+         if( le( lsort, window[ max ].begin, window[ max ].end, window[ j ].begin, window[ j ].end ) ) {
+            max = j;
+            continue;
+         }
+         ++late;
+         if( ( window[ 0 ].begin != data ) && ( j >= WINDOW / 2 ) && !le( lsort, window[ 0 ].begin, window[ 0 ].end, window[ j ].begin, window[ j ].end ) ) {
+            ++far;
+            continue;
+         }
+         size_t bytes = 0;
+         for( size_t k = j; k-- != 0; ) {
+            if( !le( lsort, window[ k ].begin, window[ k ].end, window[ j ].begin, window[ j ].end ) ) {
+               bytes += window[ k ].end - window[ k ].begin;
+            }
+         }
+         if( bytes > displacement ) {
+            displacement = bytes;
+         }
+      }
+   }
+
+   // the insertion engine moves each late line back by up to the displacement,
+   // which max_distance must allow; the block engine sorts blocks of half the
+   // buffer first, which must cover it; the merge engine keeps the late lines
+   // in the buffer; the external engine has none of these limits
+   const size_t total = end - data;
+   const size_t max_distance = lsort->options.max_distance;
+   const size_t buffer_size = lsort->options.buffer_size;
+   const double late_fraction = ( lines != 0 ) ? ( (double)late / lines ) : 0;
+   const double late_bytes = late_fraction * total;
+   const double moved = ( sampled != 0 ) ? late_fraction * lines * total / sampled * displacement : 0;
+   const int reach = ( far == 0 ) && ( ( max_distance == 0 ) || ( displacement <= max_distance ) );
+
+   int result;
+   char reason[ 160 ];
+   if( late == 0 ) {
+      result = LSORT_ENGINE_INSERTION;
+      snprintf( reason, sizeof( reason ), "no late lines in %lu sampled lines", lines );
+   }
+   else if( reach && ( moved <= total ) ) {
+      result = LSORT_ENGINE_INSERTION;
+      snprintf( reason, sizeof( reason ), "%.2f%% late lines, shifted by up to %lu bytes, about %.0f bytes moved", 100 * late_fraction, displacement, moved );
+   }
+   else if( reach && ( displacement <= buffer_size / 2 ) ) {
+      result = LSORT_ENGINE_BLOCK;
+      snprintf( reason, sizeof( reason ), "%.2f%% late lines, shifted by up to %lu bytes, within blocks of %lu bytes", 100 * late_fraction, displacement, buffer_size / 2 );
+   }
+   else {
+      result = ( late_bytes <= buffer_size ) ? LSORT_ENGINE_MERGE : LSORT_ENGINE_EXTERNAL;
+      const int n = ( far != 0 ) ? snprintf( reason, sizeof( reason ), "%.2f%% late lines, %lu of %lu far from their place", 100 * late_fraction, far, late )
+                                 : snprintf( reason, sizeof( reason ), "%.2f%% late lines, shifted by up to %lu bytes", 100 * late_fraction, displacement );
+      snprintf( reason + n, sizeof( reason ) - n, ", about %.0f bytes of them %s the buffer", late_bytes, ( result == LSORT_ENGINE_MERGE ) ? "fit" : "exceed" );
+   }
+   if( lsort->options.log != NULL ) {
+      fprintf( lsort->options.log, "%s: using %s engine, %s (%lu inversions)\n", lsort->name, lsort_engine_names[ result ], reason, inversions );
+   }
+   return result;
+}
+
+#define KEY_WINDOW 65536
+
+// the cached key of the line i lines before the current one, or NULL
+static inline struct key* window_key( struct lsort* lsort, size_t i )
+{
+   if( i >= lsort->window_count ) {
+      return NULL;
+   }
+   return &lsort->window[ lsort->window_first + lsort->window_count - 1 - i ];
+}
+
+// copies the keys of the window to a new arena, dropping keys of lines that left it
+static void compact_keys( struct lsort* lsort )
+{
+   char* data = (char*)malloc( lsort->arena.capacity );
+   if( data == NULL ) {
+      return;
+   }
+   size_t size = 0;
+   for( size_t i = 0; i != lsort->window_count; ++i ) {
+      struct key* key = &lsort->window[ lsort->window_first + i ];
+      memcpy( data + size, lsort->arena.data + key->offset, key->size );
+      key->offset = size;
+      size += key->size;
+   }
+   free( lsort->arena.data );
+   lsort->arena.data = data;
+   lsort->arena.size = size;
+}
+
+// inserts a key into the window below the newest `above` keys, the oldest key
+// is dropped when the window is full
+static int insert_key( struct lsort* lsort, size_t above, const struct key* key )
+{
+   if( above > lsort->window_count ) {
+      return 0;
+   }
+   if( lsort->window_count == KEY_WINDOW ) {
+      if( above == lsort->window_count ) {
+         return 0;
+      }
+      lsort->window_bytes -= lsort->window[ lsort->window_first ].size;
+      ++lsort->window_first;
+      --lsort->window_count;
+   }
+   if( lsort->window_first + lsort->window_count == lsort->window_capacity ) {
+      if( ( lsort->window_first != 0 ) && ( lsort->window_first >= lsort->window_count ) ) {
+         memmove( lsort->window, lsort->window + lsort->window_first, lsort->window_count * sizeof( struct key ) );
+         lsort->window_first = 0;
+      }
+      else {
+         const size_t capacity = ( lsort->window_capacity == 0 ) ? 4096 : ( lsort->window_capacity * 2 );
+         struct key* tmp = (struct key*)realloc( lsort->window, capacity * sizeof( struct key ) );
+         if( tmp == NULL ) {
+            return out_of_memory( lsort );
+         }
+         lsort->window = tmp;
+         lsort->window_capacity = capacity;
+      }
+   }
+   struct key* pos = lsort->window + lsort->window_first + lsort->window_count - above;
+   memmove( pos + 1, pos, above * sizeof( struct key ) );
+   *pos = *key;
+   ++lsort->window_count;
+   lsort->window_bytes += key->size;
+   return 0;
+}
+
+// le() for the insertion sort, which passes the cached keys of the lines or NULL
+static ALWAYS_INLINE int le_cached( struct lsort* lsort, const int keyed, const struct key* lhs_key, char* lhs_begin, char* lhs_end, const struct key* rhs_key, char* rhs_begin, char* rhs_end )
+{
+   ++lsort->stats.comparisons;
+   if( !keyed ) {
+      return le_lines( lsort, lhs_begin, lhs_end, rhs_begin, rhs_end );
+   }
+   return le_extracted( lsort, lhs_key, lhs_begin, lhs_end, rhs_key, rhs_begin, rhs_end );
+}
+
+// moves each line back (or forward) to its place, [data, current) is always sorted;
+// instantiated with and without keys, so byte-wise comparisons stay inline
+static ALWAYS_INLINE int insertion_pass( struct lsort* lsort, char* data, char* end, const int keyed )
+{
+   const size_t max_distance = lsort->options.max_distance;
+   const char delimiter = lsort->options.delimiter;
+   char* msync_begin = NULL;
+   char* msync_end = NULL;
+
+   char* prev = data;
+   char* current = find_line( lsort, prev, end );
+
+   size_t current_line = lsort->header_lines + 2;
+
+   // with extracted keys, each line's key is cached from when it is the current line
+   struct key current_key = { 0, 0 };
+   lsort->window_first = 0;
+   lsort->window_count = 0;
+   lsort->window_bytes = 0;
+   lsort->arena.size = 0;
+   if( keyed && ( current != end ) ) {
+      if( ( extract( lsort, &lsort->arena, prev, current, &current_key ) != 0 ) || ( insert_key( lsort, 0, &current_key ) != 0 ) ) {
+         return -1;
+      }
+   }
+
+   while( !cancelled( lsort ) && ( current != end ) ) {
+      set_progress( lsort, current - data, current_line - 1 );
+
+      char* next = find_line( lsort, current, end );
+      if( keyed ) {
+         if( lsort->arena.size >= 2 * lsort->window_bytes + 4096 ) {
+            compact_keys( lsort );
+         }
+         if( extract( lsort, &lsort->arena, current, next, &current_key ) != 0 ) {
+            break;
+         }
+      }
+      if( !le_cached( lsort, keyed, window_key( lsort, 0 ), prev, current, &current_key, current, next ) ) {
+         enter( lsort, LSORT_PHASE_SEARCH );
+         size_t prev_line = current_line - 1;
+         while( !cancelled( lsort ) && ( prev != data ) ) {
+            if( max_distance != 0 ) {
+               const size_t distance = next - prev;
+               if( distance > max_distance ) {
+                  if( lsort->options.fallback ) {
+                     goto external;
+                  }
+                  fail( lsort, "%s:%lu: Backward distance exceeds allowed maximum of %lu", lsort->name, current_line, max_distance );
+                  goto error;
+               }
+            }
+
+            char* const peek = rfind_line( lsort, data, prev );
+            if( !le_cached( lsort, keyed, window_key( lsort, current_line - prev_line ), peek, prev, &current_key, current, next ) ) {
+               prev = peek;
+               --prev_line;
+            }
+            else {
+               break;
+            }
+         }
+
+         size_t next_line = current_line;
+         if( prev_line + 1 == current_line ) {
+            while( !cancelled( lsort ) && ( next != end ) ) {
+               if( max_distance != 0 ) {
+                  const size_t distance = next - prev;
+                  if( distance > max_distance ) {
+                     if( lsort->options.fallback ) {
+                        goto external;
+                     }
+                     fail( lsort, "%s:%lu: Forward distance exceeds allowed maximum of %lu", lsort->name, prev_line, max_distance );
+                     goto error;
+                  }
+               }
+
+               char* const peek = find_line( lsort, next, end );
+               if( !le_cached( lsort, keyed, window_key( lsort, 0 ), prev, current, NULL, next, peek ) ) {
+                  next = peek;
+                  ++next_line;
+               }
+               else {
+                  break;
+               }
+            }
+         }
+
+         if( lsort->options.log != NULL ) {
+            if( next_line == current_line ) {
+               fprintf( lsort->options.log, "\r%s:%lu: move back to %lu\n", lsort->name, current_line, prev_line );
+            }
+            else {
+               fprintf( lsort->options.log, "\r%s:%lu: move forward to %lu\n", lsort->name, prev_line, next_line );
+            }
+         }
+
+         enter( lsort, LSORT_PHASE_MOVE );
+         count_move( lsort );
+         if( next_line == current_line ) {
+            ++lsort->stats.moved_back;
+         }
+         else {
+            ++lsort->stats.moved_forward;
+         }
+         if( (size_t)( next - prev ) > lsort->stats.max_shift ) {
+            lsort->stats.max_shift = next - prev;
+         }
+
+         char* new_begin = cmin( msync_begin, prev );
+         char* new_end = cmax( msync_end, next );
+
+         if( max_distance != 0 ) {
+            const size_t new_size = new_end - new_begin;
+            if( new_size > max_distance ) {
+               sync_range( lsort, msync_begin, msync_end - msync_begin );
+               new_begin = prev;
+               new_end = next;
+            }
+         }
+
+         const size_t prev_size = current - prev;
+         size_t current_size = next - current;
+
+         // the last line of the data may lack a delimiter, it takes the one
+         // (with crlf, maybe "\r\n") from the end of the lines it passes
+         const size_t missing = ( current[ current_size - 1 ] != delimiter ) ? terminator_size( lsort, prev, current ) : 0;
+         const size_t kept = ( missing != 0 ) ? missing : 1;
+
+         const size_t required_bufsize = zmin( prev_size, current_size + missing );
+         if( lsort->bufsize < required_bufsize ) {
+            char* tmp = (char*)realloc( lsort->buffer, required_bufsize );
+            if( tmp == NULL ) {
+               fail( lsort, "%s:%lu: Out of memory reserving %lu bytes", lsort->name, current_line, required_bufsize );
+               goto error;
+            }
+            lsort->buffer = tmp;
+            lsort->bufsize = required_bufsize;
+         }
+         char* const buffer = lsort->buffer;
+
+         if( current_size + missing <= prev_size ) {
+            memcpy( buffer, current, current_size );
+            memcpy( buffer + current_size, current - missing, missing );
+            current_size += missing;
+            memmove( prev + current_size, prev, prev_size - kept );
+            memcpy( prev, buffer, current_size );
+            lsort->stats.bytes_moved += 2 * current_size + prev_size - kept;
+         }
+         else {
+            memcpy( buffer, prev, prev_size );
+            memmove( prev, prev + prev_size, current_size );
+            memcpy( prev + current_size, buffer + prev_size - missing, missing );
+            current_size += missing;
+            memcpy( prev + current_size, buffer, prev_size - kept );
+            lsort->stats.bytes_moved += current_size + 2 * prev_size - kept;
+         }
+
+         if( !lsort->options.immediate ) {
+            msync_begin = new_begin;
+            msync_end = new_end;
+         }
+         else {
+            sync_range( lsort, new_begin, new_end - new_begin );
+         }
+
+         if( keyed ) {
+            if( next_line == current_line ) {
+               if( insert_key( lsort, current_line - prev_line, &current_key ) != 0 ) {
+                  goto error;
+               }
+            }
+            else {
+               struct key* key = window_key( lsort, 0 );
+               lsort->window_bytes += current_key.size - key->size;
+               *key = current_key;
+            }
+         }
+
+         if( next_line == current_line ) {
+            current = next;
+            prev = rfind_line( lsort, data, current );
+            ++current_line;
+         }
+         else {
+            current = find_line( lsort, prev, end );
+            current_line = prev_line + 1;
+         }
+         enter( lsort, LSORT_PHASE_SCAN );
+      }
+      else {
+         if( msync_begin != NULL ) {
+            sync_range( lsort, msync_begin, msync_end - msync_begin );
+            msync_begin = NULL;
+            msync_end = NULL;
+         }
+         if( keyed && ( insert_key( lsort, 0, &current_key ) != 0 ) ) {
+            break;
+         }
+         prev = current;
+         current = next;
+         ++current_line;
+      }
+   }
+   if( current == end ) {
+      set_progress( lsort, end - data, current_line - 1 );
+   }
+
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   return 0;
+
+external:
+   enter( lsort, LSORT_PHASE_SORT );
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   if( lsort->options.log != NULL ) {
+      fprintf( lsort->options.log, "\r%s:%lu: distance exceeds maximum of %lu, using external merge sort\n", lsort->name, current_line, max_distance );
+   }
+   // the external sort counts the lines from the current one on
+   lsort->stats.lines = current_line - 1;
+   return external_sort( lsort, data, current, end );
+
+error:
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   return -1;
+}
+
+static int insertion_sort( struct lsort* lsort, char* data, char* end )
+{
+   if( lsort->options.extract != NULL ) {
+      return insertion_pass( lsort, data, end, 1 );
+   }
+   return insertion_pass( lsort, data, end, 0 );
+}
+
+static inline uint32_t load_be32( const char* p )
+{
+   uint32_t v;
+   memcpy( &v, p, sizeof( v ) );
+#if defined( __BYTE_ORDER__ ) && ( __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ )
+   v = __builtin_bswap32( v );
+#elif !defined( __BYTE_ORDER__ ) || ( __BYTE_ORDER__ != __ORDER_BIG_ENDIAN__ )
+   const unsigned char* u = (const unsigned char*)p;
+   v = ( (uint32_t)u[ 0 ] << 24 ) | ( (uint32_t)u[ 1 ] << 16 ) | ( (uint32_t)u[ 2 ] << 8 ) | u[ 3 ];
+#endif
+   return v;
+}
+
+static inline uint64_t load_be64( const char* p )
+{
+   return ( (uint64_t)load_be32( p ) << 32 ) | load_be32( p + 4 );
+}
+
+// lhs <= rhs for records, keys of 4, 8 or 16 bytes are compared as integers
+// when width is set, otherwise like lines
+static ALWAYS_INLINE int le_records( struct lsort* lsort, const char* lhs, const char* rhs, const size_t width )
+{
+   ++lsort->stats.comparisons;
+   lhs += lsort->options.key_offset;
+   rhs += lsort->options.key_offset;
+   if( width == 4 ) {
+      const uint32_t l = load_be32( lhs );
+      const uint32_t r = load_be32( rhs );
+      return ( l == r ) || ( ( l < r ) != lsort->options.reverse );
+   }
+   if( ( width == 8 ) || ( width == 16 ) ) {
+      uint64_t l = load_be64( lhs );
+      uint64_t r = load_be64( rhs );
+      if( ( width == 16 ) && ( l == r ) ) {
+         l = load_be64( lhs + 8 );
+         r = load_be64( rhs + 8 );
+      }
+      return ( l == r ) || ( ( l < r ) != lsort->options.reverse );
+   }
+   return le_keys( lsort, lhs, lsort->options.key_length, rhs, lsort->options.key_length );
+}
+
+// equal records by ascending position
+static int compare_records( const void* lhs, const void* rhs )
+{
+   char* const l = *(char* const*)lhs;
+   char* const r = *(char* const*)rhs;
+   if( l == r ) {
+      return 0;
+   }
+   if( !le_records( sorting, l, r, 0 ) ) {
+      return 1;
+   }
+   if( !le_records( sorting, r, l, 0 ) ) {
+      return -1;
+   }
+   return ( l < r ) ? -1 : 1;
+}
+
+// sorts all records with qsort() of their addresses, then moves each record
+// to its place once by following the cycles of the permutation
+static int sort_all_records( struct lsort* lsort, char* data, size_t count )
+{
+   const size_t size = lsort->options.record_size;
+   char** index = (char**)malloc( count * sizeof( char* ) );
+   if( index == NULL ) {
+      fail( lsort, "%s: Out of memory reserving %lu bytes", lsort->name, count * sizeof( char* ) );
+      return -1;
+   }
+   for( size_t i = 0; i != count; ++i ) {
+      index[ i ] = data + i * size;
+   }
+
+   struct lsort* const previous = sorting;
+   sorting = lsort;
+   qsort( index, count, sizeof( char* ), compare_records );
+   sorting = previous;
+
+   char* const buffer = lsort->buffer;
+   for( size_t i = 0; !cancelled( lsort ) && ( i != count ); ++i ) {
+      char* const target = data + i * size;
+      if( index[ i ] == target ) {
+         continue;
+      }
+      memcpy( buffer, target, size );
+      size_t j = i;
+      while( index[ j ] != target ) {
+         char* const source = index[ j ];
+         memcpy( data + j * size, source, size );
+         lsort->stats.bytes_moved += size;
+         index[ j ] = data + j * size;
+         j = ( source - data ) / size;
+      }
+      memcpy( data + j * size, buffer, size );
+      lsort->stats.bytes_moved += 2 * size;
+      index[ j ] = data + j * size;
+      count_move( lsort );
+   }
+   free( index );
+   sync_range( lsort, data, count * size );
+   set_progress( lsort, count * size, count );
+   return 0;
+}
+
+// like insertion_pass(), but the records before the current one are
+// addressed directly, so the place of a late record is found by a galloping
+// search over the sorted records before it
+static ALWAYS_INLINE int record_pass( struct lsort* lsort, char* data, size_t count, const size_t width )
+{
+   const size_t size = lsort->options.record_size;
+   const size_t max_distance = lsort->options.max_distance;
+   const size_t reach = ( max_distance != 0 ) ? max_distance / size : count;
+   char* msync_begin = NULL;
+   char* msync_end = NULL;
+
+   for( size_t i = 1; !cancelled( lsort ) && ( i < count ); ++i ) {
+      char* const current = data + i * size;
+      set_progress( lsort, current - data, i );
+
+      if( le_records( lsort, current - size, current, width ) ) {
+         if( msync_begin != NULL ) {
+            sync_range( lsort, msync_begin, msync_end - msync_begin );
+            msync_begin = NULL;
+            msync_end = NULL;
+         }
+         continue;
+      }
+
+      // the record goes before the first greater one at or after limit,
+      // which is past i if max_distance is less than the record size
+      enter( lsort, LSORT_PHASE_SEARCH );
+      const size_t limit = ( i + 1 > reach ) ? i + 1 - reach : 0;
+      size_t lo = limit;
+      size_t hi = i - 1;
+      for( size_t step = 1; hi > lo; step *= 2 ) {
+         const size_t probe = ( hi - lo > step ) ? hi - step : lo;
+         if( le_records( lsort, data + probe * size, current, width ) ) {
+            lo = probe + 1;
+            break;
+         }
+         hi = probe;
+      }
+      while( lo < hi ) {
+         const size_t mid = lo + ( hi - lo ) / 2;
+         if( le_records( lsort, data + mid * size, current, width ) ) {
+            lo = mid + 1;
+         }
+         else {
+            hi = mid;
+         }
+      }
+      if( ( limit >= i ) || ( ( lo == limit ) && ( limit != 0 ) && !le_records( lsort, data + ( limit - 1 ) * size, current, width ) ) ) {
+         if( lsort->options.fallback ) {
+            goto fallback;
+         }
+         fail( lsort, "%s:%lu: Backward distance exceeds allowed maximum of %lu", lsort->name, i + 1, max_distance );
+         goto error;
+      }
+
+      // if it only goes before the previous record, that one may be the one
+      // out of place, it is moved forward before the first record not less
+      char* prev = data + lo * size;
+      char* next = current + size;
+      if( lo + 1 == i ) {
+         while( !cancelled( lsort ) && ( next != data + count * size ) && !le_records( lsort, prev, next, width ) ) {
+            if( ( max_distance != 0 ) && ( (size_t)( next + size - prev ) > max_distance ) ) {
+               if( lsort->options.fallback ) {
+                  goto fallback;
+               }
+               fail( lsort, "%s:%lu: Forward distance exceeds allowed maximum of %lu", lsort->name, i, max_distance );
+               goto error;
+            }
+            next += size;
+         }
+      }
+      const int forward = ( next != current + size );
+
+      if( lsort->options.log != NULL ) {
+         if( !forward ) {
+            fprintf( lsort->options.log, "\r%s:%lu: move back to %lu\n", lsort->name, i + 1, lo + 1 );
+         }
+         else {
+            fprintf( lsort->options.log, "\r%s:%lu: move forward to %lu\n", lsort->name, i, (size_t)( next - data ) / size );
+         }
+      }
+
+      enter( lsort, LSORT_PHASE_MOVE );
+      count_move( lsort );
+      if( !forward ) {
+         ++lsort->stats.moved_back;
+      }
+      else {
+         ++lsort->stats.moved_forward;
+      }
+      if( (size_t)( next - prev ) > lsort->stats.max_shift ) {
+         lsort->stats.max_shift = next - prev;
+      }
+
+      char* new_begin = cmin( msync_begin, prev );
+      char* new_end = cmax( msync_end, next );
+
+      if( max_distance != 0 ) {
+         const size_t new_size = new_end - new_begin;
+         if( new_size > max_distance ) {
+            sync_range( lsort, msync_begin, msync_end - msync_begin );
+            new_begin = prev;
+            new_end = next;
+         }
+      }
+
+      if( !forward ) {
+         memcpy( lsort->buffer, current, size );
+         memmove( prev + size, prev, current - prev );
+         memcpy( prev, lsort->buffer, size );
+      }
+      else {
+         memcpy( lsort->buffer, prev, size );
+         memmove( prev, prev + size, next - prev - size );
+         memcpy( next - size, lsort->buffer, size );
+         // the records which moved back one place still have to be scanned
+         --i;
+      }
+      lsort->stats.bytes_moved += next - prev + size;
+
+      if( !lsort->options.immediate ) {
+         msync_begin = new_begin;
+         msync_end = new_end;
+      }
+      else {
+         sync_range( lsort, new_begin, new_end - new_begin );
+      }
+      enter( lsort, LSORT_PHASE_SCAN );
+   }
+   if( !cancelled( lsort ) ) {
+      set_progress( lsort, count * size, count );
+   }
+
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   return 0;
+
+fallback:
+   enter( lsort, LSORT_PHASE_SORT );
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   if( lsort->options.log != NULL ) {
+      fprintf( lsort->options.log, "\r%s:%lu: distance exceeds maximum of %lu, sorting all records in memory\n", lsort->name, lsort->stats.lines + 1, max_distance );
+   }
+   return sort_all_records( lsort, data, count );
+
+error:
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   return -1;
+}
+
+static int sort_records( struct lsort* lsort, char* data, char* end )
+{
+   const size_t size = lsort->options.record_size;
+   const size_t total = end - data;
+   if( total % size != 0 ) {
+      fail( lsort, "%s: Size %lu is not a multiple of the record size %lu", lsort->name, total, size );
+      return -1;
+   }
+   if( ( lsort->options.key_length == 0 ) || ( lsort->options.key_offset + lsort->options.key_length > size ) ) {
+      fail( lsort, "%s: Key at offset %lu exceeds the record size %lu", lsort->name, lsort->options.key_offset, size );
+      return -1;
+   }
+   if( lsort->bufsize < size ) {
+      char* tmp = (char*)realloc( lsort->buffer, size );
+      if( tmp == NULL ) {
+         fail( lsort, "%s: Out of memory reserving %lu bytes", lsort->name, size );
+         return -1;
+      }
+      lsort->buffer = tmp;
+      lsort->bufsize = size;
+   }
+   const size_t count = total / size;
+   if( ( lsort->options.compare == NULL ) && !lsort->options.fold ) {
+      switch( lsort->options.key_length ) {
+         case 4:
+            return record_pass( lsort, data, count, 4 );
+         case 8:
+            return record_pass( lsort, data, count, 8 );
+         case 16:
+            return record_pass( lsort, data, count, 16 );
+      }
+   }
+   return record_pass( lsort, data, count, 0 );
+}
+
+// the end of the length prefix of a record
+static char* frame_payload( struct lsort* lsort, char* begin )
+{
+   if( lsort->options.framing != LSORT_FRAMING_VARINT ) {
+      return begin + 4;
+   }
+   while( ( *begin & 0x80 ) != 0 ) {
+      ++begin;
+   }
+   return begin + 1;
+}
+
+// the end of the record at pos, or NULL if it is cut off by end
+static char* frame_end( struct lsort* lsort, char* pos, char* end )
+{
+   uint64_t size = 0;
+   if( lsort->options.framing == LSORT_FRAMING_VARINT ) {
+      for( unsigned shift = 0;; shift += 7 ) {
+         if( ( pos == end ) || ( shift > 63 ) ) {
+            return NULL;
+         }
+         const unsigned char c = *pos++;
+         size |= (uint64_t)( c & 0x7f ) << shift;
+         if( ( c & 0x80 ) == 0 ) {
+            break;
+         }
+      }
+   }
+   else {
+      if( end - pos < 4 ) {
+         return NULL;
+      }
+      if( lsort->options.framing == LSORT_FRAMING_BE32 ) {
+         size = load_be32( pos );
+      }
+      else {
+         const unsigned char* u = (const unsigned char*)pos;
+         size = ( (uint32_t)u[ 3 ] << 24 ) | ( (uint32_t)u[ 2 ] << 16 ) | ( (uint32_t)u[ 1 ] << 8 ) | u[ 0 ];
+      }
+      pos += 4;
+   }
+   if( size > (uint64_t)( end - pos ) ) {
+      return NULL;
+   }
+   return pos + size;
+}
+
+// lhs <= rhs for framed records, by the keys in their payloads
+static int le_frames( struct lsort* lsort, char* lhs_begin, char* lhs_end, char* rhs_begin, char* rhs_end )
+{
+   ++lsort->stats.comparisons;
+   const size_t offset = lsort->options.key_offset;
+   const size_t length = lsort->options.key_length;
+   char* lhs = frame_payload( lsort, lhs_begin ) + offset;
+   char* rhs = frame_payload( lsort, rhs_begin ) + offset;
+   size_t lhs_size = ( lhs < lhs_end ) ? lhs_end - lhs : 0;
+   size_t rhs_size = ( rhs < rhs_end ) ? rhs_end - rhs : 0;
+   if( length != 0 ) {
+      lhs_size = zmin( lhs_size, length );
+      rhs_size = zmin( rhs_size, length );
+   }
+   return le_keys( lsort, lhs, lhs_size, rhs, rhs_size );
+}
+
+// equal records by ascending position
+static int compare_frames( const void* lhs, const void* rhs )
+{
+   const struct line* l = (const struct line*)lhs;
+   const struct line* r = (const struct line*)rhs;
+   if( l->begin == r->begin ) {
+      return 0;
+   }
+   if( !le_frames( sorting, l->begin, l->end, r->begin, r->end ) ) {
+      return 1;
+   }
+   if( !le_frames( sorting, r->begin, r->end, l->begin, l->end ) ) {
+      return -1;
+   }
+   return ( l->begin < r->begin ) ? -1 : 1;
+}
+
+// sorts all records with qsort(), writes them to a temporary file in order
+// and reads them back
+static int sort_all_frames( struct lsort* lsort, char* data, char* end )
+{
+   size_t count = 0;
+   for( char* pos = data; pos != end; ++count ) {
+      char* const next = frame_end( lsort, pos, end );
+      if( next == NULL ) {
+         fail( lsort, "%s:%lu: Record at byte %lu exceeds the end of the data", lsort->name, count + 1, (size_t)( pos - data ) );
+         return -1;
+      }
+      pos = next;
+   }
+   struct line* records = (struct line*)malloc( count * sizeof( struct line ) );
+   if( records == NULL ) {
+      fail( lsort, "%s: Out of memory reserving %lu bytes", lsort->name, count * sizeof( struct line ) );
+      return -1;
+   }
+   char* pos = data;
+   for( size_t i = 0; i != count; ++i ) {
+      records[ i ].begin = pos;
+      records[ i ].end = pos = frame_end( lsort, pos, end );
+   }
+
+   struct lsort* const previous = sorting;
+   sorting = lsort;
+   qsort( records, count, sizeof( struct line ), compare_frames );
+   sorting = previous;
+
+   FILE* file = create_temporary();
+   if( file == NULL ) {
+      goto error;
+   }
+   for( size_t i = 0; i != count; ++i ) {
+      fwrite( records[ i ].begin, 1, records[ i ].end - records[ i ].begin, file );
+   }
+   if( ( fflush( file ) != 0 ) || ( fseek( file, 0, SEEK_SET ) != 0 ) || ( fread( data, 1, end - data, file ) != (size_t)( end - data ) ) ) {
+      goto error;
+   }
+   lsort->stats.bytes_moved += 2 * ( end - data );
+   fclose( file );
+   free( records );
+   sync_range( lsort, data, end - data );
+   set_progress( lsort, end - data, count );
+   return 0;
+
+error:
+   fail( lsort, "%s: Temporary file: %s", lsort->name, strerror( errno ) );
+   if( file != NULL ) {
+      fclose( file );
+   }
+   free( records );
+   return -1;
+}
+
+// like record_pass(), but the beginnings of the records before the current
+// one are kept in an index, from the last one which is out of reach of
+// max_distance on, as framed records can only be found going forward; without
+// max_distance, all of them are kept
+static int frame_pass( struct lsort* lsort, char* data, char* end )
+{
+   const size_t max_distance = lsort->options.max_distance;
+   char** index = NULL;
+   size_t first = 0;
+   size_t count = 0;
+   size_t capacity = 0;
+   int dropped = 0;  // records before index[ first ] are out of reach
+   char* msync_begin = NULL;
+   char* msync_end = NULL;
+   int result = 0;
+
+   char* current = data;
+   size_t current_record = 1;
+   while( !cancelled( lsort ) && ( current != end ) ) {
+      char* next = frame_end( lsort, current, end );
+      if( next == NULL ) {
+         fail( lsort, "%s:%lu: Record at byte %lu exceeds the end of the data", lsort->name, current_record, (size_t)( current - data ) );
+         goto error;
+      }
+      set_progress( lsort, current - data, current_record - 1 );
+
+      if( max_distance != 0 ) {
+         while( ( count > 1 ) && ( (size_t)( next - index[ first + 1 ] ) > max_distance ) ) {
+            ++first;
+            --count;
+            dropped = 1;
+         }
+      }
+      if( first + count + 1 >= capacity ) {
+         if( ( capacity != 0 ) && ( first >= count ) ) {
+            memmove( index, index + first, count * sizeof( char* ) );
+            first = 0;
+         }
+         else {
+            const size_t new_capacity = ( capacity == 0 ) ? 1024 : 2 * capacity;
+            char** tmp = (char**)realloc( index, new_capacity * sizeof( char* ) );
+            if( tmp == NULL ) {
+               fail( lsort, "%s:%lu: Out of memory reserving %lu bytes", lsort->name, current_record, new_capacity * sizeof( char* ) );
+               goto error;
+            }
+            index = tmp;
+            capacity = new_capacity;
+         }
+      }
+
+      const size_t last = first + count - 1;
+      if( ( count == 0 ) || le_frames( lsort, index[ last ], current, current, next ) ) {
+         if( msync_begin != NULL ) {
+            sync_range( lsort, msync_begin, msync_end - msync_begin );
+            msync_begin = NULL;
+            msync_end = NULL;
+         }
+         index[ first + count++ ] = current;
+         current = next;
+         ++current_record;
+         continue;
+      }
+
+      // the record goes before the first greater one at or after limit,
+      // index[ first ] may only be left to compare with; if it goes before
+      // index[ first ], the dropped records before it would have to be compared
+      enter( lsort, LSORT_PHASE_SEARCH );
+      const size_t limit = ( ( max_distance != 0 ) && ( (size_t)( next - index[ first ] ) > max_distance ) ) ? first + 1 : first;
+      size_t lo = limit;
+      size_t hi = last;
+      for( size_t step = 1; hi > lo; step *= 2 ) {
+         const size_t probe = ( hi - lo > step ) ? hi - step : lo;
+         if( le_frames( lsort, index[ probe ], index[ probe + 1 ], current, next ) ) {
+            lo = probe + 1;
+            break;
+         }
+         hi = probe;
+      }
+      while( lo < hi ) {
+         const size_t mid = lo + ( hi - lo ) / 2;
+         if( le_frames( lsort, index[ mid ], index[ mid + 1 ], current, next ) ) {
+            lo = mid + 1;
+         }
+         else {
+            hi = mid;
+         }
+      }
+      if( ( limit > last ) || ( ( lo == limit ) && ( ( limit != first ) ? !le_frames( lsort, index[ first ], index[ limit ], current, next ) : dropped ) ) ) {
+         if( lsort->options.fallback ) {
+            goto fallback;
+         }
+         fail( lsort, "%s:%lu: Backward distance exceeds allowed maximum of %lu", lsort->name, current_record, max_distance );
+         goto error;
+      }
+
+      // if it only goes before the previous record, that one may be the one
+      // out of place, it is moved forward before the first record not less
+      char* prev = index[ lo ];
+      char* target = next;
+      size_t target_record = current_record;
+      if( lo == last ) {
+         while( !cancelled( lsort ) && ( target != end ) ) {
+            char* const peek = frame_end( lsort, target, end );
+            if( peek == NULL ) {
+               fail( lsort, "%s:%lu: Record at byte %lu exceeds the end of the data", lsort->name, target_record + 1, (size_t)( target - data ) );
+               goto error;
+            }
+            if( le_frames( lsort, prev, current, target, peek ) ) {
+               break;
+            }
+            if( ( max_distance != 0 ) && ( (size_t)( peek - prev ) > max_distance ) ) {
+               if( lsort->options.fallback ) {
+                  goto fallback;
+               }
+               fail( lsort, "%s:%lu: Forward distance exceeds allowed maximum of %lu", lsort->name, current_record - 1, max_distance );
+               goto error;
+            }
+            target = peek;
+            ++target_record;
+         }
+      }
+      const int forward = ( target != next );
+
+      if( lsort->options.log != NULL ) {
+         if( !forward ) {
+            fprintf( lsort->options.log, "\r%s:%lu: move back to %lu\n", lsort->name, current_record, current_record - ( last - lo + 1 ) );
+         }
+         else {
+            fprintf( lsort->options.log, "\r%s:%lu: move forward to %lu\n", lsort->name, current_record - 1, target_record );
+         }
+      }
+
+      enter( lsort, LSORT_PHASE_MOVE );
+      count_move( lsort );
+      if( !forward ) {
+         ++lsort->stats.moved_back;
+      }
+      else {
+         ++lsort->stats.moved_forward;
+      }
+      if( (size_t)( target - prev ) > lsort->stats.max_shift ) {
+         lsort->stats.max_shift = target - prev;
+      }
+
+      char* new_begin = cmin( msync_begin, prev );
+      char* new_end = cmax( msync_end, target );
+
+      if( max_distance != 0 ) {
+         const size_t new_size = new_end - new_begin;
+         if( new_size > max_distance ) {
+            sync_range( lsort, msync_begin, msync_end - msync_begin );
+            new_begin = prev;
+            new_end = target;
+         }
+      }
+
+      // the record that is moved goes through the buffer
+      const size_t size = forward ? (size_t)( current - prev ) : (size_t)( next - current );
+      if( lsort->bufsize < size ) {
+         char* tmp = (char*)realloc( lsort->buffer, size );
+         if( tmp == NULL ) {
+            fail( lsort, "%s:%lu: Out of memory reserving %lu bytes", lsort->name, current_record, size );
+            goto error;
+         }
+         lsort->buffer = tmp;
+         lsort->bufsize = size;
+      }
+      if( !forward ) {
+         memcpy( lsort->buffer, current, size );
+         memmove( prev + size, prev, current - prev );
+         memcpy( prev, lsort->buffer, size );
+         for( size_t i = last + 1; i != lo; --i ) {
+            index[ i ] = index[ i - 1 ] + size;
+         }
+         index[ lo ] = prev;
+         ++count;
+         current = next;
+         ++current_record;
+      }
+      else {
+         memcpy( lsort->buffer, prev, size );
+         memmove( prev, current, target - current );
+         memcpy( target - size, lsort->buffer, size );
+         // the records which moved back still have to be scanned
+         --count;
+         current = prev;
+         --current_record;
+      }
+      lsort->stats.bytes_moved += target - prev + size;
+
+      if( !lsort->options.immediate ) {
+         msync_begin = new_begin;
+         msync_end = new_end;
+      }
+      else {
+         sync_range( lsort, new_begin, new_end - new_begin );
+      }
+      enter( lsort, LSORT_PHASE_SCAN );
+   }
+   if( current == end ) {
+      set_progress( lsort, end - data, current_record - 1 );
+   }
+   goto done;
+
+fallback:
+   enter( lsort, LSORT_PHASE_SORT );
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+      msync_begin = NULL;
+   }
+   if( lsort->options.log != NULL ) {
+      fprintf( lsort->options.log, "\r%s:%lu: distance exceeds maximum of %lu, sorting all records in memory\n", lsort->name, current_record, max_distance );
+   }
+   result = sort_all_frames( lsort, data, end );
+   goto done;
+
+error:
+   result = -1;
+
+done:
+   if( msync_begin != NULL ) {
+      sync_range( lsort, msync_begin, msync_end - msync_begin );
+   }
+   free( index );
+   return result;
+}
+
+static int sort( struct lsort* lsort, char* data, char* end )
+{
+   if( lsort->options.record_size != 0 ) {
+      return sort_records( lsort, data, end );
+   }
+   if( lsort->options.framing != LSORT_FRAMING_NONE ) {
+      return frame_pass( lsort, data, end );
+   }
+   const int engine = lsort->options.engine;
+   const int selected = ( engine == LSORT_ENGINE_AUTO ) ? select_engine( lsort, data, end ) : engine;
+   if( selected != LSORT_ENGINE_INSERTION ) {
+      enter( lsort, LSORT_PHASE_SORT );
+   }
+   switch( selected ) {
+      case LSORT_ENGINE_MERGE:
+         return merge_late( lsort, data, end );
+      case LSORT_ENGINE_BLOCK:
+         if( sort_blocks( lsort, data, end ) != 0 ) {
+            return -1;
+         }
+         break;
+      case LSORT_ENGINE_EXTERNAL:
+         return external_sort( lsort, data, data, end );
+   }
+   enter( lsort, LSORT_PHASE_SCAN );
+   return insertion_sort( lsort, data, end );
+}
+
+char* lsort_skip_header( struct lsort* lsort, char* data, char* end )
+{
+   lsort->header_lines = 0;
+   if( ( lsort->options.record_size != 0 ) || ( lsort->options.framing != LSORT_FRAMING_NONE ) ) {
+      return data;
+   }
+   while( ( lsort->header_lines != lsort->options.header ) && ( data != end ) ) {
+      data = find_line( lsort, data, end );
+      ++lsort->header_lines;
+   }
+   return data;
+}
+
+void lsort_detect( struct lsort* lsort, const char* data, const char* end )
+{
+   if( lsort->options.crlf >= 0 ) {
+      lsort->crlf = lsort->options.crlf;
+      return;
+   }
+   const char* const pos = ( data != end ) ? (const char*)memchr( data, lsort->options.delimiter, end - data ) : NULL;
+   lsort->crlf = ( pos != NULL ) && ( pos != data ) && ( *( pos - 1 ) == '\r' );
+}
+
+static void begin_stats( struct lsort* lsort, size_t size )
+{
+   const unsigned available = lsort->stats.counters_available;
+   const int kernel = lsort->stats.counters_kernel;
+   memset( &lsort->stats, 0, sizeof( lsort->stats ) );
+   lsort->stats.size = size;
+   lsort->stats.counters_available = available;
+   lsort->stats.counters_kernel = kernel;
+   atomic_store_explicit( &lsort->phase, LSORT_PHASE_SCAN, memory_order_relaxed );
+   atomic_store_explicit( &lsort->progress_bytes, 0, memory_order_relaxed );
+   atomic_store_explicit( &lsort->progress_lines, 0, memory_order_relaxed );
+   atomic_store_explicit( &lsort->progress_moves, 0, memory_order_relaxed );
+   atomic_store_explicit( &lsort->progress_size, size, memory_order_relaxed );
+   if( lsort->options.stats ) {
+      lsort->phase_start = lsort_now();
+      if( lsort->perf_group != -1 ) {
+         read_counters( lsort, lsort->perf_last );
+      }
+   }
+}
+
+static void end_stats( struct lsort* lsort )
+{
+   enter( lsort, LSORT_PHASE_SCAN );
+   lsort->stats.bufsize = lsort->bufsize;
+}
+
+static int run( struct lsort* lsort, const char* name, char* data, size_t size )
+{
+   lsort->name = ( name != NULL ) ? name : "buffer";
+   lsort->error[ 0 ] = '\0';
+   if( cancelled( lsort ) ) {
+      return 1;
+   }
+   begin_stats( lsort, size );
+   lsort_detect( lsort, data, data + size );
+   char* const begin = lsort_skip_header( lsort, data, data + size );
+   set_progress( lsort, begin - data, lsort->header_lines );
+   const int result = ( begin != data + size ) ? sort( lsort, begin, data + size ) : 0;
+   end_stats( lsort );
+   if( lsort->failed ) {
+      lsort->failed = 0;
+      atomic_store_explicit( &lsort->cancelled, 0, memory_order_relaxed );
+      return -1;
+   }
+   if( result != 0 ) {
+      return result;
+   }
+   return cancelled( lsort ) ? 1 : 0;
+}
+
+void lsort_default_options( struct lsort_options* options )
+{
+   memset( options, 0, sizeof( *options ) );
+   options->engine = LSORT_ENGINE_INSERTION;
+   options->buffer_size = (size_t)256 << 20;
+   options->sync = LSORT_SYNC_ASYNC;
+   options->separator = -1;
+   options->delimiter = '\n';
+}
+
+struct lsort* lsort_create( const struct lsort_options* options )
+{
+   struct lsort* lsort = (struct lsort*)calloc( 1, sizeof( struct lsort ) );
+   if( lsort == NULL ) {
+      return NULL;
+   }
+   lsort->options = *options;
+   if( ( options->record_size > options->key_offset ) && ( options->key_length == 0 ) ) {
+      lsort->options.key_length = options->record_size - options->key_offset;
+   }
+   if( ( options->extract == NULL ) && ( options->key_count != 0 ) ) {
+      // the keys and the names of JSON fields are copied into a single block
+      size_t size = options->key_count * sizeof( struct lsort_key );
+      for( size_t i = 0; i != options->key_count; ++i ) {
+         if( options->keys[ i ].json != NULL ) {
+            size += strlen( options->keys[ i ].json ) + 1;
+         }
+      }
+      lsort->keys = (struct lsort_key*)malloc( size );
+      if( lsort->keys == NULL ) {
+         free( lsort );
+         return NULL;
+      }
+      memcpy( lsort->keys, options->keys, options->key_count * sizeof( struct lsort_key ) );
+      char* names = (char*)( lsort->keys + options->key_count );
+      for( size_t i = 0; i != options->key_count; ++i ) {
+         if( options->keys[ i ].json != NULL ) {
+            strcpy( names, options->keys[ i ].json );
+            lsort->keys[ i ].json = names;
+            names += strlen( names ) + 1;
+         }
+      }
+      lsort->options.keys = lsort->keys;
+      lsort->options.extract = lsort_extract_keys;
+      lsort->options.extract_arg = lsort;
+   }
+   if( lsort->options.extract != NULL ) {
+      // keys are folded when they are extracted
+      lsort->options.fold = 0;
+   }
+   if( options->record_start != NULL ) {
+      lsort->record_start_size = strlen( options->record_start );
+      lsort->record_start = (char*)malloc( lsort->record_start_size + 1 );
+      if( lsort->record_start == NULL ) {
+         free( lsort->keys );
+         free( lsort );
+         return NULL;
+      }
+      memcpy( lsort->record_start, options->record_start, lsort->record_start_size + 1 );
+      lsort->options.record_start = lsort->record_start;
+      lsort->options.multiline = 1;
+   }
+   lsort->crlf = ( options->crlf > 0 );
+   lsort->msync_mode = ( options->sync == LSORT_SYNC_SYNC ) ? MS_SYNC : ( ( options->sync == LSORT_SYNC_ASYNC ) ? MS_ASYNC : 0 );
+   lsort->perf_group = -1;
+   if( options->perf ) {
+      lsort->options.stats = 1;
+      open_counters( lsort );
+      for( int i = 0; i != LSORT_COUNTERS; ++i ) {
+         if( ( lsort->perf_group != -1 ) && ( lsort->perf_slot[ i ] != -1 ) ) {
+            lsort->stats.counters_available |= 1u << i;
+         }
+      }
+   }
+   return lsort;
+}
+
+void lsort_destroy( struct lsort* lsort )
+{
+   if( lsort == NULL ) {
+      return;
+   }
+   if( lsort->perf_group != -1 ) {
+      close( lsort->perf_group );
+   }
+   free( lsort->buffer );
+   free( lsort->keys );
+   free( lsort->record_start );
+   free( lsort->window );
+   free( lsort->arena.data );
+   free( lsort->scratch[ 0 ].data );
+   free( lsort->scratch[ 1 ].data );
+   free( lsort->collate[ 0 ].data );
+   free( lsort->collate[ 1 ].data );
+   free( lsort );
+}
+
+int lsort_sort_buffer( struct lsort* lsort, const char* name, char* data, size_t size )
+{
+   return run( lsort, name, data, size );
+}
+
+int lsort_sort_fd( struct lsort* lsort, const char* name, int fd )
+{
+   if( name == NULL ) {
+      name = "file";
+   }
+   struct stat st;
+   errno = 0;
+   if( fstat( fd, &st ) < 0 ) {
+      lsort->name = name;
+      return fail( lsort, "%s: %s", name, strerror( errno ) );
+   }
+
+   const size_t size = st.st_size;
+   if( size == 0 ) {
+      return run( lsort, name, NULL, 0 );
+   }
+
+   char* const data = (char*)mmap( NULL, size, PROT_READ | PROT_WRITE, lsort->options.dry_run ? MAP_PRIVATE : MAP_SHARED, fd, 0 );
+   if( data == MAP_FAILED ) {
+      lsort->name = name;
+      return fail( lsort, "%s: %s", name, strerror( errno ) );
+   }
+   const int result = run( lsort, name, data, size );
+   munmap( data, size );
+   return result;
+}
+
+void lsort_cancel( struct lsort* lsort )
+{
+   atomic_store_explicit( &lsort->cancelled, 1, memory_order_relaxed );
+}
+
+const char* lsort_error( const struct lsort* lsort )
+{
+   return lsort->error;
+}
+
+const struct lsort_stats* lsort_stats( const struct lsort* lsort )
+{
+   return &lsort->stats;
+}
+
+void lsort_progress( const struct lsort* lsort, struct lsort_progress* progress )
+{
+   progress->size = atomic_load_explicit( &lsort->progress_size, memory_order_relaxed );
+   progress->bytes = atomic_load_explicit( &lsort->progress_bytes, memory_order_relaxed );
+   progress->lines = atomic_load_explicit( &lsort->progress_lines, memory_order_relaxed );
+   progress->moves = atomic_load_explicit( &lsort->progress_moves, memory_order_relaxed );
+   progress->phase = phase( lsort );
+}
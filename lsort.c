@@ -7,27 +7,83 @@
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <locale.h>
+#include <pthread.h>
 #include <signal.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "lsort_internal.h"
+
 char* prg;
 
-size_t max_compare = 0;
-size_t max_distance = 0;
-int reverse = 0;
-int immediate = 0;
+struct lsort_options options;
+struct lsort* context = NULL;
+struct lsort_key* keys = NULL;
+size_t key_count = 0;
+unsigned key_flags = 0;
+int check = 0;
+int check_all = 0;
+int analyze = 0;
+long threads = 1;
 int quiet = 0;
 int verbose = 0;
-int msync_mode = MS_ASYNC;
-int mmap_flags = MAP_SHARED;
 
-char* buffer = NULL;
-size_t bufsize = 0;
+struct file_stats
+{
+   const char* filename;
+   struct lsort_stats stats;
+};
+
+const char* stats_names[] = { "none", "text", "json", NULL };
+int stats_format = 0;
+struct file_stats* all_stats = NULL;
+size_t all_stats_count = 0;
+
+#define PROGRESS_TICK 0.1
+#define PROGRESS_INTERVAL 1.0
+
+FILE* progress_out = NULL;
+int progress_running = 0;
+pthread_t progress_thread;
+pthread_mutex_t progress_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t progress_cond = PTHREAD_COND_INITIALIZER;
+const char* progress_file = NULL;
+size_t progress_size = 0;
+double progress_start = 0;
+
+volatile sig_atomic_t status = 0;
+
+// appends a zeroed key to keys
+struct lsort_key* add_key()
+{
+   struct lsort_key* tmp = (struct lsort_key*)realloc( keys, ( key_count + 1 ) * sizeof( struct lsort_key ) );
+   if( tmp == NULL ) {
+      fprintf( stderr, "%s: Out of memory\n", prg );
+      exit( EXIT_FAILURE );
+   }
+   keys = tmp;
+   memset( &keys[ key_count ], 0, sizeof( struct lsort_key ) );
+   return &keys[ key_count++ ];
+}
+
+// a single character or "\\0", -1 if invalid
+int parse_char( const char* arg )
+{
+   if( strcmp( arg, "\\0" ) == 0 ) {
+      return '\0';
+   }
+   if( ( arg[ 0 ] != '\0' ) && ( arg[ 1 ] == '\0' ) ) {
+      return (unsigned char)arg[ 0 ];
+   }
+   return -1;
+}
 
 void print_version()
 {
@@ -43,12 +99,56 @@ void print_help()
                     "  -c, --compare N            compare no more than N characters per line\n"
                     "  -d, --distance N           maximum shift distance in bytes, default: 1M\n"
                     "  -r, --reverse              reverse sort order\n"
+                    "  -k, --key KEYDEF           sort by a key, may be given more than once\n"
+                    "  -t, --field-separator SEP  use SEP instead of non-blank to blank transition\n"
+                    "  -b, --ignore-leading-blanks\n"
+                    "                             ignore leading blanks in key fields\n"
+                    "  -f, --ignore-case          fold lower case to upper case characters\n"
+                    "  -n, --numeric-sort         compare according to string numerical value\n"
+                    "  -g, --general-numeric-sort compare according to general numerical value\n"
+                    "  -h, --human-numeric-sort   compare human readable numbers (e.g., 2K 1G)\n"
+                    "  -V, --version-sort         natural sort of (version) numbers within text\n"
+                    "      --time-sort            compare according to timestamps, see below\n"
+                    "      --collate              compare according to the collation order of\n"
+                    "                             the locale (LC_COLLATE), not bytewise\n"
+                    "      --json-key FIELD       sort by FIELD of JSON object lines, may be given\n"
+                    "                             more than once and mixed with --key\n"
+                    "  -z, --zero-terminated      line delimiter is NUL, not newline\n"
+                    "      --record-separator SEP use SEP as line delimiter, \\0 for NUL\n"
+                    "      --crlf[=auto]          lines end with CR LF, the CR is not compared;\n"
+                    "                             with auto, if the first line of FILE does\n"
+                    "      --header N             keep the first N lines of each FILE on top,\n"
+                    "                             only the lines after them are sorted\n"
+                    "      --multiline            keep lines which start with a blank with the line\n"
+                    "                             before them, they are sorted as one line\n"
+                    "      --record-start PREFIX  like --multiline, but keep lines which do not start\n"
+                    "                             with PREFIX with the line before them\n"
+                    "      --record-size N        sort binary records of N bytes instead of lines\n"
+                    "      --framing NAME         sort records with a length prefix instead of lines,\n"
+                    "                             NAME is varint, le32 or be32\n"
+                    "      --key-offset N         key of each record (or its payload) starts at\n"
+                    "                             byte N, default: 0\n"
+                    "      --key-length N         key of each record is N bytes long,\n"
+                    "                             default: the rest of the record\n"
                     "      --sync                 use synchronous writes\n"
                     "      --immediate            disable deferred writes\n"
                     "      --dry-run              perform a trial run with no changes made\n"
+                    "  -C, --check[=all]          check whether FILE(s) are sorted, do not sort;\n"
+                    "                             report the first or all disorders\n"
+                    "      --analyze              report how far lines are from their place, do not sort\n"
+                    "      --threads N            use N threads for --check and --analyze,\n"
+                    "                             0 for one per CPU, default: 1\n"
+                    "      --fallback             use an external merge sort when --distance is exceeded\n"
+                    "  -S, --buffer-size N        memory budget for --fallback, default: 256M\n"
+                    "      --engine NAME          use engine NAME, default: insertion\n"
                     "\n"
                     "  -q, --quiet                suppress progress output\n"
                     "  -v, --verbose              report changes to the file\n"
+                    "      --progress-fd N        write progress records in JSON to file descriptor N\n"
+                    "      --stats[=FORMAT]       report statistics to stderr at exit,\n"
+                    "                             FORMAT is text (default) or json\n"
+                    "      --perf                 add hardware performance counters per phase\n"
+                    "                             to the statistics, implies --stats\n"
                     "      --help                 display this help and exit\n"
                     "      --version              output version information and exit\n"
                     "\n"
@@ -58,80 +158,904 @@ void print_help()
                     "By default, --compare is 0, meaning no limit when comparing lines.\n"
                     "A non-zero value for --compare may result in non-sorted files.\n"
                     "\n"
+                    "KEYDEF is F[.C][OPTS][,F[.C][OPTS]] for start and stop position, where F is a\n"
+                    "field number and C a character position in the field; both are origin 1, and\n"
+                    "the stop position defaults to the line's end. If neither -t nor -b is in\n"
+                    "effect, characters in a field are counted from the beginning of the preceding\n"
+                    "whitespace. OPTS is one or more single-letter ordering options [bcfghnrTV],\n"
+                    "which override global ordering options for that key; c is --collate and T is\n"
+                    "--time-sort. Lines with equal keys keep their relative order.\n"
+                    "\n"
+                    "--time-sort recognizes ISO 8601/RFC 3339 (2021-03-04T05:06:07.123+01:00),\n"
+                    "syslog (Mar  4 05:06:07) and Apache CLF (04/Mar/2021:05:06:07 +0100)\n"
+                    "timestamps at the start of the key or in its first brackets. Times without an\n"
+                    "offset are UTC, syslog times are in 1970. Lines without a timestamp go first.\n"
+                    "\n"
+                    "--json-key compares the value of a top-level field of each line's JSON object:\n"
+                    "missing fields and null go first, then false, true, numbers (compared exactly)\n"
+                    "and strings. With an ordering option like -n, the value is compared that way.\n"
+                    "\n"
+                    "With --record-size, keys are compared as unsigned big-endian numbers (that is,\n"
+                    "bytewise), records with equal keys keep their relative order. With --framing,\n"
+                    "each record is a protobuf-style varint or a 4-byte little- or big-endian\n"
+                    "length followed by that many bytes of payload; keys cut off by the end of the\n"
+                    "payload are shorter. The positions of the records within the distance are\n"
+                    "kept in memory, 8 bytes each; with -d 0, those of all records of FILE.\n"
+                    "\n"
+                    "With --progress-fd, a record with the bytes and lines processed, the moves,\n"
+                    "the throughput in MB/s and the estimated seconds remaining is written once\n"
+                    "per second while a file is sorted, and a final record when it is done.\n"
+                    "\n"
+                    "With --fallback, the remaining part of the file is sorted in runs which are\n"
+                    "written to temporary files in $TMPDIR (or /tmp) and merged back in-place.\n"
+                    "\n"
+                    "Engines:\n"
+                    "  insertion   move each line back to its place, best for few, close lines\n"
+                    "  merge       move late lines aside and merge them back, best for few lines\n"
+                    "              which are far from their place\n"
+                    "  block       sort blocks of --buffer-size/2 bytes in memory first, best for\n"
+                    "              many lines which are close to their place\n"
+                    "  external    external merge sort of the whole file\n"
+                    "  auto        sample the file and choose one of the above\n"
+                    "\n"
                     "Report bugs to: <https://github.com/d-frey/lsort/>\n",
             prg );
 }
 
-size_t zmin( size_t a, size_t b )
+struct disorder
+{
+   size_t line;
+   char* begin;
+   char* end;
+};
+
+struct chunk
+{
+   struct lsort* lsort;
+   char* data;
+   char* begin;
+   char* end;
+   char* data_end;
+   size_t lines;
+   struct disorder* disorders;
+   size_t count;
+   size_t capacity;
+   int error;
+};
+
+void* check_chunk( void* arg )
 {
-   return ( a < b ) ? a : b;
+   struct chunk* chunk = (struct chunk*)arg;
+   char* prev = ( chunk->begin != chunk->data ) ? lsort_rfind( chunk->lsort, chunk->data, chunk->begin ) : NULL;
+   char* pos = chunk->begin;
+   while( ( status == 0 ) && ( pos != chunk->end ) ) {
+      char* next = lsort_find( chunk->lsort, pos, chunk->data_end );
+      ++chunk->lines;
+      if( ( prev != NULL ) && !lsort_le( chunk->lsort, prev, pos, pos, next ) ) {
+         if( chunk->count == chunk->capacity ) {
+            chunk->capacity = ( chunk->capacity == 0 ) ? 64 : ( chunk->capacity * 2 );
+            struct disorder* tmp = (struct disorder*)realloc( chunk->disorders, chunk->capacity * sizeof( struct disorder ) );
+            if( tmp == NULL ) {
+               chunk->error = ENOMEM;
+               break;
+            }
+            chunk->disorders = tmp;
+         }
+         chunk->disorders[ chunk->count ].line = chunk->lines;
+         chunk->disorders[ chunk->count ].begin = pos;
+         chunk->disorders[ chunk->count ].end = next;
+         ++chunk->count;
+         if( !check_all ) {
+            break;
+         }
+      }
+      prev = pos;
+      pos = next;
+   }
+   return NULL;
 }
 
-char* cmin( char* a, char* b )
+// maps a file read-only, returns NULL for empty files and MAP_FAILED on errors
+char* map_file( const char* filename, size_t* size )
 {
-   return ( a == NULL ) ? b : ( ( a < b ) ? a : b );
+   errno = 0;
+   const int fd = open( filename, O_RDONLY );
+   if( fd < 0 ) {
+      perror( filename );
+      return (char*)MAP_FAILED;
+   }
+
+   struct stat st;
+   errno = 0;
+   if( fstat( fd, &st ) < 0 ) {
+      perror( filename );
+      close( fd );
+      return (char*)MAP_FAILED;
+   }
+
+   *size = st.st_size;
+   if( *size == 0 ) {
+      close( fd );
+      return NULL;
+   }
+
+   char* const data = (char*)mmap( NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0 );
+   if( data == MAP_FAILED ) {
+      perror( filename );
+   }
+   else {
+      madvise( data, *size, MADV_SEQUENTIAL );
+   }
+   close( fd );
+   return data;
 }
 
-char* cmax( char* a, char* b )
+size_t chunk_count( size_t size )
 {
-   return ( a == NULL ) ? b : ( ( a > b ) ? a : b );
+   const long n = ( threads > 0 ) ? threads : sysconf( _SC_NPROCESSORS_ONLN );
+   if( ( n <= 0 ) || ( size / n < 65536 ) ) {
+      return 1;
+   }
+   return n;
 }
 
-// lhs <= rhs
-int le( char* lhs_begin, char* lhs_end, char* rhs_begin, char* rhs_end )
+// splits [data, end) into n chunks at line boundaries, some chunks may be empty
+void split( char* data, char* end, size_t n, char** bounds )
 {
-   if( ( lhs_end != lhs_begin ) && ( *( lhs_end - 1 ) == '\n' ) ) {
-      --lhs_end;
+   bounds[ 0 ] = data;
+   for( size_t i = 1; i != n; ++i ) {
+      char* pos = data + ( end - data ) / n * i;
+      bounds[ i ] = ( pos <= bounds[ i - 1 ] ) ? bounds[ i - 1 ] : lsort_find( context, pos - 1, end );
    }
-   if( ( rhs_end != rhs_begin ) && ( *( rhs_end - 1 ) == '\n' ) ) {
-      --rhs_end;
+   bounds[ n ] = end;
+}
+
+// runs the worker for each of the n items, the calling thread handles the first item
+void parallel( void* ( *worker )( void* ), void* items, size_t item_size, size_t n )
+{
+   pthread_t* tids = (pthread_t*)calloc( n, sizeof( pthread_t ) );
+   size_t started = 1;
+   while( ( tids != NULL ) && ( started < n ) ) {
+      if( pthread_create( &tids[ started ], NULL, worker, (char*)items + started * item_size ) != 0 ) {
+         break;
+      }
+      ++started;
    }
-   const size_t lhs_size = lhs_end - lhs_begin;
-   const size_t rhs_size = rhs_end - rhs_begin;
-   size_t size = zmin( lhs_size, rhs_size );
-   if( ( max_compare != 0 ) && ( size > max_compare ) ) {
-      size = max_compare;
+   worker( items );
+   for( size_t i = 1; i < started; ++i ) {
+      pthread_join( tids[ i ], NULL );
    }
-   const int result = memcmp( lhs_begin, rhs_begin, size );
-   if( result != 0 ) {
-      return ( result < 0 ) ? !reverse : reverse;
+   for( size_t i = started; i < n; ++i ) {
+      worker( (char*)items + i * item_size );
    }
-   if( ( max_compare != 0 ) && ( size == max_compare ) ) {
-      return 1;
+   free( tids );
+}
+
+// returns 0 if the file is sorted, 1 if not, and -1 on errors
+int check_file( const char* filename )
+{
+   size_t size;
+   char* const data = map_file( filename, &size );
+   if( data == MAP_FAILED ) {
+      return -1;
+   }
+   if( data == NULL ) {
+      return 0;
+   }
+   char* const end = data + size;
+
+   const size_t n = chunk_count( size );
+   struct chunk* chunks = (struct chunk*)calloc( n, sizeof( struct chunk ) );
+   char** bounds = (char**)malloc( ( n + 1 ) * sizeof( char* ) );
+   if( ( chunks == NULL ) || ( bounds == NULL ) ) {
+      fprintf( stderr, "%s: Out of memory\n", filename );
+      free( chunks );
+      free( bounds );
+      munmap( data, size );
+      return -1;
+   }
+
+   int result = 0;
+   char* const begin = lsort_skip_header( context, data, end );
+   split( begin, end, n, bounds );
+   for( size_t i = 0; i != n; ++i ) {
+      chunks[ i ].lsort = lsort_create( &options );
+      if( chunks[ i ].lsort == NULL ) {
+         perror( filename );
+         result = -1;
+         goto cleanup;
+      }
+      lsort_detect( chunks[ i ].lsort, data, end );
+      chunks[ i ].data = begin;
+      chunks[ i ].data_end = end;
+      chunks[ i ].begin = bounds[ i ];
+      chunks[ i ].end = bounds[ i + 1 ];
+   }
+   parallel( check_chunk, chunks, sizeof( struct chunk ), n );
+
+   size_t lines = context->header_lines;
+   for( size_t i = 0; ( i != n ) && ( ( result == 0 ) || check_all ); ++i ) {
+      if( chunks[ i ].error != 0 ) {
+         errno = chunks[ i ].error;
+         perror( filename );
+         result = -1;
+         break;
+      }
+      for( size_t j = 0; j != chunks[ i ].count; ++j ) {
+         const struct disorder* d = &chunks[ i ].disorders[ j ];
+         int length = d->end - d->begin;
+         if( ( length != 0 ) && ( d->begin[ length - 1 ] == options.delimiter ) ) {
+            --length;
+            if( chunks[ 0 ].lsort->crlf && ( length != 0 ) && ( d->begin[ length - 1 ] == '\r' ) ) {
+               --length;
+            }
+         }
+         fprintf( stderr, "%s:%lu: disorder: %.*s\n", filename, lines + d->line, length, d->begin );
+         result = 1;
+      }
+      lines += chunks[ i ].lines;
+   }
+
+cleanup:
+   for( size_t i = 0; i != n; ++i ) {
+      lsort_destroy( chunks[ i ].lsort );
+      free( chunks[ i ].disorders );
    }
-   return ( lhs_size <= rhs_size ) ? !reverse : reverse;
+   free( chunks );
+   free( bounds );
+   munmap( data, size );
+   return result;
 }
 
-#ifndef _GNU_SOURCE
-void* memrchr( void* s, int c, size_t n )
+#define BUCKETS 64
+
+struct analysis
+{
+   struct lsort* lsort;
+   struct analysis* chunks;
+   char* data;
+   char* begin;
+   char* end;
+   char* data_end;
+   int phase;
+   int error;
+
+   size_t lines;
+   size_t first_line;
+   unsigned char* max_bits;
+   unsigned char* min_bits;
+   struct line max;
+   struct line min;
+   struct line prefix_max;
+   struct line suffix_min;
+
+   size_t late;
+   size_t early;
+   size_t exceeding;
+   size_t moved;
+   size_t required;
+   size_t backward_bytes;
+   size_t backward_lines;
+   size_t backward_line;
+   size_t forward_bytes;
+   size_t forward_lines;
+   size_t forward_line;
+   size_t histogram[ 2 ][ BUCKETS ];
+};
+
+int get_bit( unsigned char* bits, size_t i )
 {
-   if( n != 0 ) {
-      unsigned char* cp = (unsigned char*)s + n;
-      do {
-         if( *( --cp ) == (unsigned char)c )
-            return cp;
-      } while( --n != 0 );
+   return ( bits[ i / 8 ] >> ( i % 8 ) ) & 1;
+}
+
+int set_bit( unsigned char** bits, size_t i, int value )
+{
+   if( i % 8192 == 0 ) {
+      unsigned char* tmp = (unsigned char*)realloc( *bits, i / 8 + 1024 );
+      if( tmp == NULL ) {
+         return -1;
+      }
+      *bits = tmp;
+   }
+   if( i % 8 == 0 ) {
+      ( *bits )[ i / 8 ] = 0;
+   }
+   ( *bits )[ i / 8 ] |= value << ( i % 8 );
+   return 0;
+}
+
+size_t bucket( size_t bytes )
+{
+   size_t result = 0;
+   while( ( bytes >>= 1 ) != 0 ) {
+      ++result;
+   }
+   return result;
+}
+
+// a line which is not smaller than any line before it
+int is_max( struct lsort* lsort, struct analysis* chunk, size_t i, char* begin, char* end )
+{
+   return get_bit( chunk->max_bits, i ) && ( ( chunk->prefix_max.begin == NULL ) || lsort_le( lsort, chunk->prefix_max.begin, chunk->prefix_max.end, begin, end ) );
+}
+
+// a line which is not larger than any line after it
+int is_min( struct lsort* lsort, struct analysis* chunk, size_t i, char* begin, char* end )
+{
+   return get_bit( chunk->min_bits, i ) && ( ( chunk->suffix_min.begin == NULL ) || lsort_le( lsort, begin, end, chunk->suffix_min.begin, chunk->suffix_min.end ) );
+}
+
+// marks the local maxima and minima
+void analyze_records( struct analysis* chunk )
+{
+   struct line max = { NULL, NULL };
+   for( char* pos = chunk->begin; pos != chunk->end; ) {
+      char* next = lsort_find( chunk->lsort, pos, chunk->end );
+      const int record = ( max.begin == NULL ) || lsort_le( chunk->lsort, max.begin, max.end, pos, next );
+      if( record ) {
+         max.begin = pos;
+         max.end = next;
+      }
+      if( set_bit( &chunk->max_bits, chunk->lines, record ) != 0 ) {
+         chunk->error = ENOMEM;
+         return;
+      }
+      ++chunk->lines;
+      pos = next;
+   }
+   chunk->max = max;
+
+   if( chunk->lines != 0 ) {
+      chunk->min_bits = (unsigned char*)calloc( chunk->lines / 8 + 1, 1 );
+      if( chunk->min_bits == NULL ) {
+         chunk->error = ENOMEM;
+         return;
+      }
+   }
+   struct line min = { NULL, NULL };
+   char* next = chunk->end;
+   for( size_t i = chunk->lines; i != 0; --i ) {
+      char* pos = lsort_rfind( chunk->lsort, chunk->begin, next );
+      if( ( min.begin == NULL ) || lsort_le( chunk->lsort, pos, next, min.begin, min.end ) ) {
+         min.begin = pos;
+         min.end = next;
+         chunk->min_bits[ ( i - 1 ) / 8 ] |= 1 << ( ( i - 1 ) % 8 );
+      }
+      next = pos;
+   }
+   chunk->min = min;
+}
+
+// measures how far each line is from its place, in lines and bytes
+void analyze_lines( struct analysis* chunk )
+{
+   struct lsort* const lsort = chunk->lsort;
+   struct analysis* const chunks = chunk->chunks;
+   const size_t c = chunk - chunks;
+   char* pos = chunk->begin;
+   for( size_t i = 0; ( status == 0 ) && ( i != chunk->lines ); ++i ) {
+      char* next = lsort_find( lsort, pos, chunk->end );
+      const size_t size = next - pos;
+      const size_t line = chunk->first_line + i;
+
+      if( !is_max( lsort, chunk, i, pos, next ) ) {
+         size_t lines = 0;
+         size_t bytes = 0;
+         size_t k = c;
+         size_t j = i;
+         char* current = pos;
+         while( current != chunk->data ) {
+            while( j == 0 ) {
+               j = chunks[ --k ].lines;
+            }
+            --j;
+            char* prev = lsort_rfind( lsort, chunk->data, current );
+            if( lsort_le( lsort, prev, current, pos, next ) ) {
+               if( is_max( lsort, &chunks[ k ], j, prev, current ) ) {
+                  break;
+               }
+            }
+            else {
+               ++lines;
+               bytes += current - prev;
+               if( ( options.max_distance != 0 ) && ( bytes + size > options.max_distance ) ) {
+                  ++chunk->exceeding;
+                  break;
+               }
+            }
+            current = prev;
+         }
+         ++chunk->late;
+         chunk->moved += bytes + size;
+         if( bytes + size > chunk->required ) {
+            chunk->required = bytes + size;
+         }
+         if( bytes > chunk->backward_bytes ) {
+            chunk->backward_bytes = bytes;
+            chunk->backward_line = line;
+         }
+         if( lines > chunk->backward_lines ) {
+            chunk->backward_lines = lines;
+         }
+         ++chunk->histogram[ 0 ][ bucket( bytes ) ];
+      }
+
+      if( !is_min( lsort, chunk, i, pos, next ) ) {
+         size_t lines = 0;
+         size_t bytes = 0;
+         size_t k = c;
+         size_t j = i;
+         char* current = next;
+         while( current != chunk->data_end ) {
+            while( ++j >= chunks[ k ].lines ) {
+               ++k;
+               j = -1;
+            }
+            char* peek = lsort_find( lsort, current, chunk->data_end );
+            if( lsort_le( lsort, pos, next, current, peek ) ) {
+               if( is_min( lsort, &chunks[ k ], j, current, peek ) ) {
+                  break;
+               }
+            }
+            else {
+               ++lines;
+               bytes += peek - current;
+               if( ( options.max_distance != 0 ) && ( bytes + size > options.max_distance ) ) {
+                  ++chunk->exceeding;
+                  break;
+               }
+            }
+            current = peek;
+         }
+         ++chunk->early;
+         if( bytes + size > chunk->required ) {
+            chunk->required = bytes + size;
+         }
+         if( bytes > chunk->forward_bytes ) {
+            chunk->forward_bytes = bytes;
+            chunk->forward_line = line;
+         }
+         if( lines > chunk->forward_lines ) {
+            chunk->forward_lines = lines;
+         }
+         ++chunk->histogram[ 1 ][ bucket( bytes ) ];
+      }
+      pos = next;
+   }
+}
+
+void* analyze_chunk( void* arg )
+{
+   struct analysis* chunk = (struct analysis*)arg;
+   if( chunk->phase == 0 ) {
+      analyze_records( chunk );
+   }
+   else {
+      analyze_lines( chunk );
    }
    return NULL;
 }
-#endif
 
-char* find( char* pos, char* end )
+int analyze_file( const char* filename )
+{
+   size_t size;
+   char* const data = map_file( filename, &size );
+   if( data == MAP_FAILED ) {
+      return -1;
+   }
+   if( data == NULL ) {
+      fprintf( stdout, "%s: empty\n", filename );
+      return 0;
+   }
+   char* const end = data + size;
+
+   const size_t n = chunk_count( size );
+   struct analysis* chunks = (struct analysis*)calloc( n, sizeof( struct analysis ) );
+   char** bounds = (char**)malloc( ( n + 1 ) * sizeof( char* ) );
+   if( ( chunks == NULL ) || ( bounds == NULL ) ) {
+      fprintf( stderr, "%s: Out of memory\n", filename );
+      free( chunks );
+      free( bounds );
+      munmap( data, size );
+      return -1;
+   }
+
+   int result = 0;
+   char* const begin = lsort_skip_header( context, data, end );
+   split( begin, end, n, bounds );
+   for( size_t i = 0; i != n; ++i ) {
+      chunks[ i ].lsort = lsort_create( &options );
+      if( chunks[ i ].lsort == NULL ) {
+         perror( filename );
+         result = -1;
+         goto cleanup;
+      }
+      lsort_detect( chunks[ i ].lsort, data, end );
+      chunks[ i ].chunks = chunks;
+      chunks[ i ].data = begin;
+      chunks[ i ].data_end = end;
+      chunks[ i ].begin = bounds[ i ];
+      chunks[ i ].end = bounds[ i + 1 ];
+   }
+   parallel( analyze_chunk, chunks, sizeof( struct analysis ), n );
+
+   for( size_t i = 0; i != n; ++i ) {
+      if( chunks[ i ].error != 0 ) {
+         errno = chunks[ i ].error;
+         perror( filename );
+         result = -1;
+         goto cleanup;
+      }
+   }
+
+   // combine the records of the chunks before and after each chunk
+   struct line max = { NULL, NULL };
+   size_t lines = context->header_lines;
+   for( size_t i = 0; i != n; ++i ) {
+      chunks[ i ].prefix_max = max;
+      chunks[ i ].first_line = lines + 1;
+      lines += chunks[ i ].lines;
+      if( ( chunks[ i ].max.begin != NULL ) && ( ( max.begin == NULL ) || lsort_le( context, max.begin, max.end, chunks[ i ].max.begin, chunks[ i ].max.end ) ) ) {
+         max = chunks[ i ].max;
+      }
+   }
+   struct line min = { NULL, NULL };
+   for( size_t i = n; i != 0; --i ) {
+      chunks[ i - 1 ].suffix_min = min;
+      if( ( chunks[ i - 1 ].min.begin != NULL ) && ( ( min.begin == NULL ) || lsort_le( context, chunks[ i - 1 ].min.begin, chunks[ i - 1 ].min.end, min.begin, min.end ) ) ) {
+         min = chunks[ i - 1 ].min;
+      }
+   }
+
+   for( size_t i = 0; i != n; ++i ) {
+      chunks[ i ].phase = 1;
+   }
+   parallel( analyze_chunk, chunks, sizeof( struct analysis ), n );
+   if( status != 0 ) {
+      goto cleanup;
+   }
+
+   struct analysis total;
+   memset( &total, 0, sizeof( total ) );
+   for( size_t i = 0; i != n; ++i ) {
+      const struct analysis* chunk = &chunks[ i ];
+      total.late += chunk->late;
+      total.early += chunk->early;
+      total.exceeding += chunk->exceeding;
+      total.moved += chunk->moved;
+      if( chunk->required > total.required ) {
+         total.required = chunk->required;
+      }
+      if( chunk->backward_bytes > total.backward_bytes ) {
+         total.backward_bytes = chunk->backward_bytes;
+         total.backward_line = chunk->backward_line;
+      }
+      if( chunk->backward_lines > total.backward_lines ) {
+         total.backward_lines = chunk->backward_lines;
+      }
+      if( chunk->forward_bytes > total.forward_bytes ) {
+         total.forward_bytes = chunk->forward_bytes;
+         total.forward_line = chunk->forward_line;
+      }
+      if( chunk->forward_lines > total.forward_lines ) {
+         total.forward_lines = chunk->forward_lines;
+      }
+      for( size_t j = 0; j != BUCKETS; ++j ) {
+         total.histogram[ 0 ][ j ] += chunk->histogram[ 0 ][ j ];
+         total.histogram[ 1 ][ j ] += chunk->histogram[ 1 ][ j ];
+      }
+   }
+
+   fprintf( stdout, "%s: %lu lines, %lu bytes\n", filename, lines, size );
+   fprintf( stdout, "  late lines:             %lu\n", total.late );
+   fprintf( stdout, "  early lines:            %lu\n", total.early );
+   fprintf( stdout, "  max backward shift:     %lu bytes (line %lu), %lu lines\n", total.backward_bytes, total.backward_line, total.backward_lines );
+   fprintf( stdout, "  max forward shift:      %lu bytes (line %lu), %lu lines\n", total.forward_bytes, total.forward_line, total.forward_lines );
+   fprintf( stdout, "  estimated bytes moved:  %lu\n", total.moved );
+   if( total.exceeding != 0 ) {
+      fprintf( stdout, "  required --distance:    more than %lu (%lu lines exceed it)\n", options.max_distance, total.exceeding );
+   }
+   else {
+      fprintf( stdout, "  required --distance:    %lu\n", total.required );
+   }
+   if( ( total.late != 0 ) || ( total.early != 0 ) ) {
+      fprintf( stdout, "  shift in bytes              late      early\n" );
+      size_t last = BUCKETS;
+      while( ( total.histogram[ 0 ][ last - 1 ] == 0 ) && ( total.histogram[ 1 ][ last - 1 ] == 0 ) ) {
+         --last;
+      }
+      size_t first = 0;
+      while( ( total.histogram[ 0 ][ first ] == 0 ) && ( total.histogram[ 1 ][ first ] == 0 ) ) {
+         ++first;
+      }
+      for( size_t j = first; j != last; ++j ) {
+         fprintf( stdout, "  %-20lu %10lu %10lu\n", ( j == 0 ) ? 0 : ( (size_t)1 << j ), total.histogram[ 0 ][ j ], total.histogram[ 1 ][ j ] );
+      }
+   }
+
+cleanup:
+   for( size_t i = 0; i != n; ++i ) {
+      lsort_destroy( chunks[ i ].lsort );
+      free( chunks[ i ].max_bits );
+      free( chunks[ i ].min_bits );
+   }
+   free( chunks );
+   free( bounds );
+   munmap( data, size );
+   return result;
+}
+
+int lookup( const char** names, char* p )
 {
-   char* result = (char*)memchr( pos, '\n', end - pos );
-   if( result != NULL ) {
-      return ++result;
+   for( int i = 0; names[ i ] != NULL; ++i ) {
+      if( strcmp( names[ i ], p ) == 0 ) {
+         return i;
+      }
    }
-   return end;
+   fprintf( stderr, "%s: Invalid argument '%s'\n", prg, p );
+   exit( EXIT_FAILURE );
 }
 
-char* rfind( char* data, char* prev )
+void end_stats( const char* filename )
 {
-   char* result = (char*)memrchr( data, '\n', prev - data - 1 );
-   if( result != NULL ) {
-      return ++result;
+   if( stats_format == 0 ) {
+      return;
    }
-   return data;
+   struct file_stats* tmp = (struct file_stats*)realloc( all_stats, ( all_stats_count + 1 ) * sizeof( struct file_stats ) );
+   if( tmp != NULL ) {
+      all_stats = tmp;
+      all_stats[ all_stats_count ].filename = filename;
+      all_stats[ all_stats_count ].stats = *lsort_stats( context );
+      ++all_stats_count;
+   }
+}
+
+void print_json_string( FILE* out, const char* s )
+{
+   fputc( '"', out );
+   for( ; *s != '\0'; ++s ) {
+      const unsigned char c = *s;
+      if( ( c == '"' ) || ( c == '\\' ) ) {
+         fprintf( out, "\\%c", c );
+      }
+      else if( c < 0x20 ) {
+         fprintf( out, "\\u%04x", c );
+      }
+      else {
+         fputc( c, out );
+      }
+   }
+   fputc( '"', out );
+}
+
+void print_text_counters( const char* filename, const struct lsort_stats* s, int phase )
+{
+   const uint64_t* counters = s->counters[ phase ];
+   fprintf( stderr, "%s: %s", filename, lsort_phase_names[ phase ] );
+   for( int i = 0; i != LSORT_COUNTERS; ++i ) {
+      if( !( s->counters_available & ( 1u << i ) ) ) {
+         fprintf( stderr, ", %s n/a", lsort_counter_names[ i ] );
+      }
+      else {
+         fprintf( stderr, ", %s %llu", lsort_counter_names[ i ], (unsigned long long)counters[ i ] );
+      }
+   }
+   if( ( s->counters_available & ( 1u << LSORT_COUNTER_CYCLES ) ) && ( s->counters_available & ( 1u << LSORT_COUNTER_INSTRUCTIONS ) ) && ( counters[ LSORT_COUNTER_CYCLES ] != 0 ) ) {
+      fprintf( stderr, ", IPC %.2f", (double)counters[ LSORT_COUNTER_INSTRUCTIONS ] / counters[ LSORT_COUNTER_CYCLES ] );
+   }
+   fprintf( stderr, s->counters_kernel ? "\n" : " (user space only)\n" );
+}
+
+void print_file_stats( const char* filename, const struct lsort_stats* s )
+{
+   double total = 0;
+   for( int i = 0; i != LSORT_PHASES; ++i ) {
+      total += s->time[ i ];
+   }
+   if( stats_format == 1 ) {
+      fprintf( stderr, "%s: %lu bytes, %lu lines, %lu comparisons\n", filename, s->size, s->lines, s->comparisons );
+      fprintf( stderr, "%s: %lu lines moved back, %lu lines moved forward, %lu bytes moved, max shift %lu bytes\n", filename, s->moved_back, s->moved_forward, s->bytes_moved, s->max_shift );
+      fprintf( stderr, "%s: %lu msync calls, %lu bytes synced, buffer %lu bytes\n", filename, s->msync_calls, s->msync_bytes, s->bufsize );
+      fprintf( stderr, "%s: ", filename );
+      for( int i = 0; i != LSORT_PHASES; ++i ) {
+         fprintf( stderr, "%s %.6fs, ", lsort_phase_names[ i ], s->time[ i ] );
+      }
+      fprintf( stderr, "total %.6fs\n", total );
+      if( options.perf ) {
+         for( int i = 0; i != LSORT_PHASES; ++i ) {
+            print_text_counters( filename, s, i );
+         }
+      }
+      return;
+   }
+   fputc( '{', stderr );
+   if( filename != NULL ) {
+      fprintf( stderr, "\"file\":" );
+      print_json_string( stderr, filename );
+      fputc( ',', stderr );
+   }
+   fprintf( stderr, "\"size\":%lu,\"lines\":%lu,\"comparisons\":%lu,\"moved_back\":%lu,\"moved_forward\":%lu,\"bytes_moved\":%lu,\"max_shift\":%lu,\"msync_calls\":%lu,\"msync_bytes\":%lu,\"buffer_size\":%lu,\"time\":{",
+            s->size, s->lines, s->comparisons, s->moved_back, s->moved_forward, s->bytes_moved, s->max_shift, s->msync_calls, s->msync_bytes, s->bufsize );
+   for( int i = 0; i != LSORT_PHASES; ++i ) {
+      fprintf( stderr, "\"%s\":%.6f,", lsort_phase_names[ i ], s->time[ i ] );
+   }
+   fprintf( stderr, "\"total\":%.6f}", total );
+   if( options.perf ) {
+      fprintf( stderr, ",\"perf\":{\"kernel\":%s", s->counters_kernel ? "true" : "false" );
+      for( int i = 0; i != LSORT_PHASES; ++i ) {
+         fprintf( stderr, ",\"%s\":{", lsort_phase_names[ i ] );
+         for( int j = 0; j != LSORT_COUNTERS; ++j ) {
+            if( j != 0 ) {
+               fputc( ',', stderr );
+            }
+            if( !( s->counters_available & ( 1u << j ) ) ) {
+               fprintf( stderr, "\"%s\":null", lsort_counter_names[ j ] );
+            }
+            else {
+               fprintf( stderr, "\"%s\":%llu", lsort_counter_names[ j ], (unsigned long long)s->counters[ i ][ j ] );
+            }
+         }
+         fputc( '}', stderr );
+      }
+      fputc( '}', stderr );
+   }
+   fputc( '}', stderr );
+}
+
+void print_stats()
+{
+   if( stats_format == 0 ) {
+      return;
+   }
+   struct lsort_stats total;
+   memset( &total, 0, sizeof( total ) );
+   if( stats_format == 2 ) {
+      fprintf( stderr, "{\"files\":[" );
+   }
+   for( size_t i = 0; i != all_stats_count; ++i ) {
+      const struct lsort_stats* s = &all_stats[ i ].stats;
+      if( ( stats_format == 2 ) && ( i != 0 ) ) {
+         fputc( ',', stderr );
+      }
+      print_file_stats( all_stats[ i ].filename, s );
+      total.size += s->size;
+      total.lines += s->lines;
+      total.comparisons += s->comparisons;
+      total.moved_back += s->moved_back;
+      total.moved_forward += s->moved_forward;
+      total.bytes_moved += s->bytes_moved;
+      if( s->max_shift > total.max_shift ) {
+         total.max_shift = s->max_shift;
+      }
+      total.msync_calls += s->msync_calls;
+      total.msync_bytes += s->msync_bytes;
+      total.counters_available = s->counters_available;
+      total.counters_kernel = s->counters_kernel;
+      if( s->bufsize > total.bufsize ) {
+         total.bufsize = s->bufsize;
+      }
+      for( int j = 0; j != LSORT_PHASES; ++j ) {
+         total.time[ j ] += s->time[ j ];
+         for( int k = 0; k != LSORT_COUNTERS; ++k ) {
+            total.counters[ j ][ k ] += s->counters[ j ][ k ];
+         }
+      }
+   }
+   if( stats_format == 2 ) {
+      fprintf( stderr, "],\"total\":" );
+      print_file_stats( NULL, &total );
+      fprintf( stderr, "}\n" );
+   }
+   else {
+      print_file_stats( "total", &total );
+   }
+}
+
+// called with progress_mutex locked
+void print_progress_record( int done )
+{
+   struct lsort_progress progress;
+   lsort_progress( context, &progress );
+   const double elapsed = lsort_now() - progress_start;
+   // the counters may still be those of the file before until it is mapped
+   const size_t bytes = ( done || ( progress.bytes > progress_size ) ) ? progress_size : progress.bytes;
+   const double rate = ( elapsed > 0 ) ? bytes / elapsed : 0;
+   fprintf( progress_out, "{\"file\":" );
+   print_json_string( progress_out, progress_file );
+   fprintf( progress_out, ",\"phase\":\"%s\",\"bytes\":%lu,\"size\":%lu,\"lines\":%lu,\"moves\":%lu,\"elapsed\":%.3f,\"mb_per_s\":%.3f,\"eta\":",
+            lsort_phase_names[ progress.phase ], bytes, progress_size, progress.lines, progress.moves, elapsed, rate / 1e6 );
+   if( done ) {
+      fprintf( progress_out, "0" );
+   }
+   else if( rate > 0 ) {
+      fprintf( progress_out, "%.3f", ( progress_size - bytes ) / rate );
+   }
+   else {
+      fprintf( progress_out, "null" );
+   }
+   fprintf( progress_out, ",\"done\":%s}\n", done ? "true" : "false" );
+   fflush( progress_out );
+}
+
+// formats the progress on a timer, the sorting loop only updates the counters
+void* report_progress( void* arg )
+{
+   (void)arg;
+   pthread_mutex_lock( &progress_mutex );
+   double next_record = lsort_now() + PROGRESS_INTERVAL;
+   while( progress_running ) {
+      struct timespec deadline;
+      clock_gettime( CLOCK_REALTIME, &deadline );
+      deadline.tv_nsec += PROGRESS_TICK * 1e9;
+      if( deadline.tv_nsec >= 1000000000 ) {
+         ++deadline.tv_sec;
+         deadline.tv_nsec -= 1000000000;
+      }
+      pthread_cond_timedwait( &progress_cond, &progress_mutex, &deadline );
+      if( !progress_running || ( progress_file == NULL ) ) {
+         continue;
+      }
+      if( !quiet && ( progress_size != 0 ) ) {
+         struct lsort_progress progress;
+         lsort_progress( context, &progress );
+         const size_t bytes = ( progress.bytes < progress_size ) ? progress.bytes : progress_size;
+         fprintf( stdout, "\r%s: %lu%%", progress_file, 100 * bytes / progress_size );
+         fflush( stdout );
+      }
+      if( ( progress_out != NULL ) && ( lsort_now() >= next_record ) ) {
+         print_progress_record( 0 );
+         next_record = lsort_now() + PROGRESS_INTERVAL;
+      }
+   }
+   pthread_mutex_unlock( &progress_mutex );
+   return NULL;
+}
+
+void start_progress()
+{
+   if( quiet && ( progress_out == NULL ) ) {
+      return;
+   }
+   progress_running = 1;
+   const int rc = pthread_create( &progress_thread, NULL, report_progress, NULL );
+   if( rc != 0 ) {
+      fprintf( stderr, "%s: Could not start progress reporting: %s\n", prg, strerror( rc ) );
+      progress_running = 0;
+   }
+}
+
+void stop_progress()
+{
+   if( !progress_running ) {
+      return;
+   }
+   pthread_mutex_lock( &progress_mutex );
+   progress_running = 0;
+   pthread_cond_signal( &progress_cond );
+   pthread_mutex_unlock( &progress_mutex );
+   pthread_join( progress_thread, NULL );
+}
+
+// the file is only reported once its size is known
+void begin_progress( const char* filename, int fd )
+{
+   struct stat st;
+   const size_t size = ( fstat( fd, &st ) == 0 ) ? (size_t)st.st_size : 0;
+   pthread_mutex_lock( &progress_mutex );
+   progress_size = size;
+   progress_file = filename;
+   progress_start = lsort_now();
+   pthread_mutex_unlock( &progress_mutex );
+}
+
+void end_progress( int done )
+{
+   pthread_mutex_lock( &progress_mutex );
+   if( progress_out != NULL ) {
+      print_progress_record( done );
+   }
+   progress_file = NULL;
+   pthread_mutex_unlock( &progress_mutex );
 }
 
 size_t parse( char* p )
@@ -186,11 +1110,12 @@ size_t parse( char* p )
    return result;
 }
 
-volatile sig_atomic_t status = 0;
-
 void stop( int signal )
 {
    status = signal;
+   if( context != NULL ) {
+      lsort_cancel( context );
+   }
 }
 
 int main( int argc, char** argv )
@@ -200,16 +1125,47 @@ int main( int argc, char** argv )
 
    prg = argv[ 0 ];
    quiet = !isatty( fileno( stdout ) );
+   lsort_default_options( &options );
 
    static struct option long_options[] = {
       { "compare", required_argument, NULL, 'c' },
       { "distance", required_argument, NULL, 'd' },
       { "reverse", no_argument, NULL, 'r' },
+      { "key", required_argument, NULL, 'k' },
+      { "field-separator", required_argument, NULL, 't' },
+      { "ignore-leading-blanks", no_argument, NULL, 'b' },
+      { "ignore-case", no_argument, NULL, 'f' },
+      { "numeric-sort", no_argument, NULL, 'n' },
+      { "general-numeric-sort", no_argument, NULL, 'g' },
+      { "human-numeric-sort", no_argument, NULL, 'h' },
+      { "version-sort", no_argument, NULL, 'V' },
+      { "time-sort", no_argument, NULL, 0 },
+      { "zero-terminated", no_argument, NULL, 'z' },
+      { "record-separator", required_argument, NULL, 0 },
+      { "crlf", optional_argument, NULL, 0 },
+      { "header", required_argument, NULL, 0 },
+      { "multiline", no_argument, NULL, 0 },
+      { "record-start", required_argument, NULL, 0 },
+      { "record-size", required_argument, NULL, 0 },
+      { "framing", required_argument, NULL, 0 },
+      { "key-offset", required_argument, NULL, 0 },
+      { "key-length", required_argument, NULL, 0 },
+      { "collate", no_argument, NULL, 0 },
+      { "json-key", required_argument, NULL, 0 },
       { "sync", no_argument, NULL, 0 },
       { "immediate", no_argument, NULL, 0 },
       { "dry-run", no_argument, NULL, 0 },
+      { "check", optional_argument, NULL, 'C' },
+      { "analyze", no_argument, NULL, 0 },
+      { "threads", required_argument, NULL, 0 },
+      { "stats", optional_argument, NULL, 0 },
+      { "perf", no_argument, NULL, 0 },
+      { "fallback", no_argument, NULL, 0 },
+      { "buffer-size", required_argument, NULL, 'S' },
+      { "engine", required_argument, NULL, 0 },
       { "quiet", no_argument, NULL, 'q' },
       { "verbose", no_argument, NULL, 'v' },
+      { "progress-fd", required_argument, NULL, 0 },
       { "help", no_argument, NULL, 0 },
       { "version", no_argument, NULL, 0 },
       { NULL, 0, NULL, 0 }
@@ -217,16 +1173,63 @@ int main( int argc, char** argv )
 
    int opt = 0;
    int long_index = 0;
-   while( ( opt = getopt_long( argc, argv, "c:d:qrv", long_options, &long_index ) ) != -1 ) {
+   while( ( opt = getopt_long( argc, argv, "bCc:d:fghk:nqrt:vS:Vz", long_options, &long_index ) ) != -1 ) {
       switch( opt ) {
+         case 'C':
+            check = 1;
+            if( optarg != NULL ) {
+               if( strcmp( optarg, "all" ) != 0 ) {
+                  fprintf( stderr, "%s: Invalid argument '%s'\n", prg, optarg );
+                  exit( EXIT_FAILURE );
+               }
+               check_all = 1;
+            }
+            break;
          case 'c':
-            max_compare = parse( optarg );
+            options.max_compare = parse( optarg );
             break;
          case 'd':
-            max_distance = parse( optarg );
+            options.max_distance = parse( optarg );
             break;
          case 'r':
-            reverse = 1;
+            options.reverse = 1;
+            break;
+         case 'k':
+            if( lsort_parse_key( optarg, add_key() ) != 0 ) {
+               fprintf( stderr, "%s: Invalid key '%s'\n", prg, optarg );
+               exit( EXIT_FAILURE );
+            }
+            break;
+         case 't':
+            options.separator = parse_char( optarg );
+            if( options.separator < 0 ) {
+               fprintf( stderr, "%s: Invalid field separator '%s'\n", prg, optarg );
+               exit( EXIT_FAILURE );
+            }
+            break;
+         case 'z':
+            options.delimiter = '\0';
+            break;
+         case 'b':
+            key_flags |= LSORT_KEY_BLANKS | LSORT_KEY_END_BLANKS;
+            break;
+         case 'f':
+            key_flags |= LSORT_KEY_FOLD;
+            break;
+         case 'n':
+            key_flags |= LSORT_KEY_NUMERIC;
+            break;
+         case 'g':
+            key_flags |= LSORT_KEY_GENERAL;
+            break;
+         case 'h':
+            key_flags |= LSORT_KEY_HUMAN;
+            break;
+         case 'V':
+            key_flags |= LSORT_KEY_VERSION;
+            break;
+         case 'S':
+            options.buffer_size = parse( optarg );
             break;
          case 'q':
             quiet = 1;
@@ -237,15 +1240,120 @@ int main( int argc, char** argv )
          case 0: {
             const char* name = long_options[ long_index ].name;
             if( strcmp( name, "sync" ) == 0 ) {
-               msync_mode = MS_SYNC;
+               options.sync = LSORT_SYNC_SYNC;
                break;
             }
             if( strcmp( name, "immediate" ) == 0 ) {
-               immediate = 1;
+               options.immediate = 1;
                break;
             }
             if( strcmp( name, "dry-run" ) == 0 ) {
-               mmap_flags = MAP_PRIVATE;
+               options.dry_run = 1;
+               break;
+            }
+            if( strcmp( name, "fallback" ) == 0 ) {
+               options.fallback = 1;
+               break;
+            }
+            if( strcmp( name, "time-sort" ) == 0 ) {
+               key_flags |= LSORT_KEY_TIME;
+               break;
+            }
+            if( strcmp( name, "record-separator" ) == 0 ) {
+               const int c = parse_char( optarg );
+               if( c < 0 ) {
+                  fprintf( stderr, "%s: Invalid record separator '%s'\n", prg, optarg );
+                  exit( EXIT_FAILURE );
+               }
+               options.delimiter = (char)c;
+               break;
+            }
+            if( strcmp( name, "crlf" ) == 0 ) {
+               options.crlf = 1;
+               if( optarg != NULL ) {
+                  if( strcmp( optarg, "auto" ) != 0 ) {
+                     fprintf( stderr, "%s: Invalid argument '%s'\n", prg, optarg );
+                     exit( EXIT_FAILURE );
+                  }
+                  options.crlf = -1;
+               }
+               break;
+            }
+            if( strcmp( name, "header" ) == 0 ) {
+               options.header = parse( optarg );
+               break;
+            }
+            if( strcmp( name, "multiline" ) == 0 ) {
+               options.multiline = 1;
+               break;
+            }
+            if( strcmp( name, "record-start" ) == 0 ) {
+               if( *optarg == '\0' ) {
+                  fprintf( stderr, "%s: Invalid record start '%s'\n", prg, optarg );
+                  exit( EXIT_FAILURE );
+               }
+               options.record_start = optarg;
+               options.multiline = 1;
+               break;
+            }
+            if( strcmp( name, "record-size" ) == 0 ) {
+               options.record_size = parse( optarg );
+               if( options.record_size == 0 ) {
+                  fprintf( stderr, "%s: Invalid record size '%s'\n", prg, optarg );
+                  exit( EXIT_FAILURE );
+               }
+               break;
+            }
+            if( strcmp( name, "framing" ) == 0 ) {
+               options.framing = lookup( lsort_framing_names, optarg );
+               break;
+            }
+            if( strcmp( name, "key-offset" ) == 0 ) {
+               options.key_offset = parse( optarg );
+               break;
+            }
+            if( strcmp( name, "key-length" ) == 0 ) {
+               options.key_length = parse( optarg );
+               break;
+            }
+            if( strcmp( name, "collate" ) == 0 ) {
+               key_flags |= LSORT_KEY_COLLATE;
+               break;
+            }
+            if( strcmp( name, "json-key" ) == 0 ) {
+               struct lsort_key* key = add_key();
+               key->begin_field = 1;
+               key->begin_char = 1;
+               key->json = optarg;
+               break;
+            }
+            if( strcmp( name, "analyze" ) == 0 ) {
+               analyze = 1;
+               break;
+            }
+            if( strcmp( name, "stats" ) == 0 ) {
+               stats_format = ( optarg != NULL ) ? lookup( stats_names, optarg ) : 1;
+               break;
+            }
+            if( strcmp( name, "progress-fd" ) == 0 ) {
+               const size_t fd = parse( optarg );
+               progress_out = ( fd <= INT_MAX ) ? fdopen( fd, "w" ) : NULL;
+               if( progress_out == NULL ) {
+                  fprintf( stderr, "%s: Invalid progress file descriptor '%s'\n", prg, optarg );
+                  exit( EXIT_FAILURE );
+               }
+               break;
+            }
+            if( strcmp( name, "perf" ) == 0 ) {
+               options.perf = 1;
+               break;
+            }
+            if( strcmp( name, "threads" ) == 0 ) {
+               threads = parse( optarg );
+               break;
+            }
+            if( strcmp( name, "engine" ) == 0 ) {
+               options.engine = lookup( lsort_engine_names, optarg );
                break;
             }
             if( strcmp( name, "help" ) == 0 ) {
@@ -269,227 +1377,160 @@ int main( int argc, char** argv )
       exit( EXIT_FAILURE );
    }
 
-   while( ( status == 0 ) && ( optind < argc ) ) {
-      const char* const filename = argv[ optind++ ];
-
-      errno = 0;
-      const int fd = open( filename, O_RDWR );
-      if( fd < 0 ) {
-         perror( filename );
+   // like sort(1), global ordering options apply to the whole line without
+   // keys, and to each key which has none of its own
+   if( !lsort_key_flags_valid( key_flags ) ) {
+      fprintf( stderr, "%s: Incompatible ordering options\n", prg );
+      exit( EXIT_FAILURE );
+   }
+   if( ( key_count == 0 ) && ( key_flags == LSORT_KEY_FOLD ) ) {
+      // whole lines are folded as they are compared, without keys
+      options.fold = 1;
+      key_flags = 0;
+   }
+   if( ( options.record_size != 0 ) || ( options.framing != LSORT_FRAMING_NONE ) ) {
+      if( ( options.record_size != 0 ) && ( options.framing != LSORT_FRAMING_NONE ) ) {
+         fprintf( stderr, "%s: --record-size cannot be combined with --framing\n", prg );
          exit( EXIT_FAILURE );
       }
-
-      struct stat st;
-      errno = 0;
-      if( fstat( fd, &st ) < 0 ) {
-         perror( filename );
-         close( fd );
+      if( check || analyze ) {
+         fprintf( stderr, "%s: Records cannot be checked or analyzed\n", prg );
          exit( EXIT_FAILURE );
       }
-
-      const size_t size = st.st_size;
-      if( size == 0 ) {
-         if( !quiet ) {
-            fprintf( stdout, "%s: done\n", filename );
-         }
-         close( fd );
-         continue;
+      if( options.header != 0 ) {
+         fprintf( stderr, "%s: Records have no header lines\n", prg );
+         exit( EXIT_FAILURE );
       }
-
-      char* const data = (char*)mmap( NULL, size, PROT_READ | PROT_WRITE, mmap_flags, fd, 0 );
-      if( data == (void*)-1 ) {
-         perror( filename );
-         close( fd );
+      if( ( key_count != 0 ) || ( key_flags != 0 ) ) {
+         fprintf( stderr, "%s: Records are sorted by --key-offset and --key-length, not by keys\n", prg );
          exit( EXIT_FAILURE );
       }
-
-      char* const end = data + size;
-
-      char* prev = data;
-      char* current = find( prev, end );
-
-      size_t current_line = 2;
-      size_t last_progress = 1000;
-
-      char* msync_begin = NULL;
-      char* msync_end = NULL;
-
-      while( ( status == 0 ) && ( current != end ) ) {
-         if( !quiet ) {
-            const size_t progress = 100 * ( current - data ) / ( end - data );
-            if( last_progress != progress ) {
-               fprintf( stdout, "\r%s: %lu%%", filename, progress );
-               fflush( stdout );
-               last_progress = progress;
-            }
+      if( ( options.record_size != 0 ) && ( ( options.key_offset >= options.record_size ) || ( options.key_length > options.record_size - options.key_offset ) ) ) {
+         fprintf( stderr, "%s: Key exceeds the record size\n", prg );
+         exit( EXIT_FAILURE );
+      }
+   }
+   else if( ( options.key_offset != 0 ) || ( options.key_length != 0 ) ) {
+      fprintf( stderr, "%s: --key-offset and --key-length require --record-size or --framing\n", prg );
+      exit( EXIT_FAILURE );
+   }
+   if( ( key_count == 0 ) && ( key_flags != 0 ) ) {
+      keys = (struct lsort_key*)calloc( 1, sizeof( struct lsort_key ) );
+      if( keys == NULL ) {
+         fprintf( stderr, "%s: Out of memory\n", prg );
+         exit( EXIT_FAILURE );
+      }
+      keys[ 0 ].begin_field = 1;
+      keys[ 0 ].begin_char = 1;
+      key_count = 1;
+   }
+   if( key_count != 0 ) {
+      if( options.reverse ) {
+         key_flags |= LSORT_KEY_REVERSE;
+         options.reverse = 0;
+      }
+      int collate = 0;
+      for( size_t i = 0; i != key_count; ++i ) {
+         if( keys[ i ].flags == 0 ) {
+            keys[ i ].flags = key_flags;
          }
+         collate |= ( keys[ i ].flags & LSORT_KEY_COLLATE ) != 0;
+      }
+      if( collate && ( setlocale( LC_COLLATE, "" ) == NULL ) ) {
+         fprintf( stderr, "%s: Invalid locale, using the C locale\n", prg );
+      }
+      options.keys = keys;
+      options.key_count = key_count;
+   }
 
-         char* next = find( current, end );
-         if( !le( prev, current, current, next ) ) {
-            size_t prev_line = current_line - 1;
-            while( ( status == 0 ) && ( prev != data ) ) {
-               if( max_distance != 0 ) {
-                  const size_t distance = next - prev;
-                  if( distance > max_distance ) {
-                     if( !quiet ) {
-                        putchar( '\n' );
-                     }
-                     fprintf( stderr, "%s:%lu: Backward distance exceeds allowed maximum of %lu\n", filename, current_line, max_distance );
-                     goto exit_with_error;
-                  }
-               }
-
-               char* const peek = rfind( data, prev );
-               if( !le( peek, prev, current, next ) ) {
-                  prev = peek;
-                  --prev_line;
-               }
-               else {
-                  break;
-               }
-            }
-
-            size_t next_line = current_line;
-            if( prev_line + 1 == current_line ) {
-               while( ( status == 0 ) && ( next != end ) ) {
-                  if( max_distance != 0 ) {
-                     const size_t distance = next - prev;
-                     if( distance > max_distance ) {
-                        if( !quiet ) {
-                           putchar( '\n' );
-                        }
-                        fprintf( stderr, "%s:%lu: Forward distance exceeds allowed maximum of %lu\n", filename, prev_line, max_distance );
-                        goto exit_with_error;
-                     }
-                  }
-
-                  char* const peek = find( next, end );
-                  if( !le( prev, current, next, peek ) ) {
-                     next = peek;
-                     ++next_line;
-                  }
-                  else {
-                     break;
-                  }
-               }
-            }
-
-            if( verbose ) {
-               if( next_line == current_line ) {
-                  fprintf( stdout, "\r%s:%lu: move back to %lu\n", filename, current_line, prev_line );
-               }
-               else {
-                  fprintf( stdout, "\r%s:%lu: move forward to %lu\n", filename, prev_line, next_line );
-               }
-               if( !quiet ) {
-                  fprintf( stdout, "%s: %lu%%", filename, last_progress );
-                  fflush( stdout );
-               }
-            }
-
-            char* new_begin = cmin( msync_begin, prev );
-            char* new_end = cmax( msync_end, next );
-
-            if( max_distance != 0 ) {
-               const size_t new_size = new_end - new_begin;
-               if( new_size > max_distance ) {
-                  msync( msync_begin, msync_end - msync_begin, msync_mode );
-                  new_begin = prev;
-                  new_end = next;
-               }
-            }
-
-            const size_t prev_size = current - prev;
-            size_t current_size = next - current;
+   if( options.perf && ( stats_format == 0 ) ) {
+      stats_format = 1;
+   }
+   options.stats = ( stats_format != 0 );
+   options.log = verbose ? stdout : NULL;
 
-            const size_t required_bufsize = zmin( prev_size, current_size + 1 );
-            if( bufsize < required_bufsize ) {
-               bufsize = required_bufsize;
-               buffer = (char*)realloc( buffer, bufsize );
-               if( buffer == NULL ) {
-                  if( !quiet ) {
-                     putchar( '\n' );
-                  }
-                  fprintf( stderr, "%s:%lu: Out of memory reserving %lu bytes\n", filename, current_line, bufsize );
-                  goto exit_with_error;
-               }
+   context = lsort_create( &options );
+   if( context == NULL ) {
+      perror( prg );
+      exit( EXIT_FAILURE );
+   }
+   if( options.perf ) {
+      const unsigned available = lsort_stats( context )->counters_available;
+      if( available == 0 ) {
+         fprintf( stderr, "%s: Performance counters are not available\n", prg );
+      }
+      else if( verbose ) {
+         for( int i = 0; i != LSORT_COUNTERS; ++i ) {
+            if( !( available & ( 1u << i ) ) ) {
+               fprintf( stderr, "%s: Performance counter %s is not available\n", prg, lsort_counter_names[ i ] );
             }
+         }
+      }
+   }
 
-            if( current_size <= prev_size ) {
-               memcpy( buffer, current, current_size );
-               if( buffer[ current_size - 1 ] != '\n' ) {
-                  buffer[ current_size++ ] = '\n';
-               }
-               memmove( prev + current_size, prev, prev_size - 1 );
-               memcpy( prev, buffer, current_size );
-            }
-            else {
-               memcpy( buffer, prev, prev_size );
-               memmove( prev, prev + prev_size, current_size );
-               if( prev[ current_size - 1 ] != '\n' ) {
-                  prev[ current_size++ ] = '\n';
-               }
-               memcpy( prev + current_size, buffer, prev_size - 1 );
-            }
+   if( !check && !analyze ) {
+      start_progress();
+   }
 
-            if( !immediate ) {
-               msync_begin = new_begin;
-               msync_end = new_end;
-            }
-            else {
-               msync( new_begin, new_end - new_begin, msync_mode );
-            }
+   int result = EXIT_SUCCESS;
+   while( ( status == 0 ) && ( optind < argc ) ) {
+      const char* const filename = argv[ optind++ ];
 
-            if( next_line == current_line ) {
-               current = next;
-               prev = rfind( data, current );
-               ++current_line;
-            }
-            else {
-               current = find( prev, end );
-               current_line = prev_line + 1;
-            }
+      if( check ) {
+         const int sorted = check_file( filename );
+         if( sorted < 0 ) {
+            exit( EXIT_FAILURE );
          }
-         else {
-            if( msync_begin != NULL ) {
-               msync( msync_begin, msync_end - msync_begin, msync_mode );
-               msync_begin = NULL;
-               msync_end = NULL;
-            }
-            prev = current;
-            current = next;
-            ++current_line;
+         if( sorted > 0 ) {
+            result = EXIT_FAILURE;
          }
+         continue;
       }
 
-      if( msync_begin != NULL ) {
-         msync( msync_begin, msync_end - msync_begin, msync_mode );
+      if( analyze ) {
+         if( analyze_file( filename ) < 0 ) {
+            exit( EXIT_FAILURE );
+         }
+         continue;
       }
 
-      munmap( data, size );
-      close( fd );
+      errno = 0;
+      const int fd = open( filename, O_RDWR );
+      if( fd < 0 ) {
+         perror( filename );
+         exit( EXIT_FAILURE );
+      }
 
-      if( ( status == 0 ) && !quiet ) {
-         fprintf( stdout, "\r%s: done\n", filename );
+      begin_progress( filename, fd );
+      const int sorted = lsort_sort_fd( context, filename, fd );
+      close( fd );
+      if( sorted < 0 ) {
+         if( !quiet ) {
+            putchar( '\n' );
+         }
+         fprintf( stderr, "%s\n", lsort_error( context ) );
+         exit( EXIT_FAILURE );
       }
-      continue;
+      end_stats( filename );
+      end_progress( sorted == 0 );
 
-   exit_with_error:
-      if( msync_begin != NULL ) {
-         msync( msync_begin, msync_end - msync_begin, msync_mode );
+      if( ( sorted == 0 ) && !quiet ) {
+         fprintf( stdout, "\r%s: done\n", filename );
       }
-      munmap( data, size );
-      close( fd );
-      exit( EXIT_FAILURE );
    }
 
+   stop_progress();
    if( status != 0 ) {
       if( !quiet ) {
          putchar( '\n' );
       }
       fprintf( stderr, "%s: ABORTED\n", prg );
+      print_stats();
       return EXIT_FAILURE;
    }
 
-   return EXIT_SUCCESS;
+   print_stats();
+   lsort_destroy( context );
+   free( keys );
+   return result;
 }
@@ -0,0 +1,241 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+// liblsort sorts almost-sorted lines in-place. All state lives in a context
+// created by lsort_create(), so independent contexts can be used concurrently
+// from different threads. A single context must not be used by more than one
+// thread at a time, except for lsort_cancel() and lsort_progress().
+
+#ifndef LSORT_H
+#define LSORT_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum lsort_engine
+{
+   LSORT_ENGINE_AUTO,
+   LSORT_ENGINE_INSERTION,
+   LSORT_ENGINE_MERGE,
+   LSORT_ENGINE_BLOCK,
+   LSORT_ENGINE_EXTERNAL
+};
+
+enum lsort_phase
+{
+   LSORT_PHASE_SCAN,
+   LSORT_PHASE_SEARCH,
+   LSORT_PHASE_MOVE,
+   LSORT_PHASE_SYNC,
+   LSORT_PHASE_SORT,
+   LSORT_PHASES
+};
+
+enum lsort_counter
+{
+   LSORT_COUNTER_CYCLES,
+   LSORT_COUNTER_INSTRUCTIONS,
+   LSORT_COUNTER_LLC_MISSES,
+   LSORT_COUNTER_DTLB_MISSES,
+   LSORT_COUNTER_PAGE_FAULTS,
+   LSORT_COUNTERS
+};
+
+enum lsort_sync
+{
+   LSORT_SYNC_NONE,  // for buffers that are not mapped from a file
+   LSORT_SYNC_ASYNC,
+   LSORT_SYNC_SYNC
+};
+
+// how records are framed when they are not lines, see below
+enum lsort_framing
+{
+   LSORT_FRAMING_NONE,
+   LSORT_FRAMING_VARINT,  // a base 128 varint like protobuf's writeDelimitedTo()
+   LSORT_FRAMING_LE32,    // a 4-byte little-endian length
+   LSORT_FRAMING_BE32     // a 4-byte big-endian length
+};
+
+enum lsort_key_flags
+{
+   LSORT_KEY_BLANKS = 1,      // ignore leading blanks of the start field
+   LSORT_KEY_END_BLANKS = 2,  // ignore leading blanks of the stop field
+   LSORT_KEY_REVERSE = 4,     // reverse the order of this key
+   LSORT_KEY_NUMERIC = 8,     // compare by numerical value, like sort -n
+   LSORT_KEY_GENERAL = 16,    // compare as floating point numbers, like sort -g
+   LSORT_KEY_TIME = 32,       // compare by the timestamp the key starts with, see below
+   LSORT_KEY_COLLATE = 64,    // compare by the LC_COLLATE of the current locale
+   LSORT_KEY_FOLD = 128,      // fold lower case ASCII letters to upper case, like sort -f
+   LSORT_KEY_HUMAN = 256,     // compare numbers with SI suffixes (2K, 1G), like sort -h
+   LSORT_KEY_VERSION = 512    // compare digit runs by value (file9 < file10), like sort -V
+};
+
+// NULL-terminated, indexed by the enums above
+extern const char* lsort_engine_names[];
+extern const char* lsort_framing_names[];
+extern const char* lsort_phase_names[];
+extern const char* lsort_counter_names[];
+
+// returns a value less than, equal to, or greater than zero, like memcmp;
+// the lines (or their keys, see below) are passed without their trailing newline
+typedef int ( *lsort_compare_t )( const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size, void* arg );
+
+// writes the sort key of a line to key and returns its size; if the size
+// exceeds capacity, it is called again with at least that much room. Keys are
+// extracted once per line and cached while the line is near the insertion point
+typedef size_t ( *lsort_extract_t )( const char* line, size_t size, char* key, size_t capacity, void* arg );
+
+// LSORT_KEY_TIME recognizes ISO 8601/RFC 3339 (2021-03-04T05:06:07.123+01:00,
+// the time, fraction and offset are optional), syslog (Mar  4 05:06:07) and
+// Apache CLF (04/Mar/2021:05:06:07 +0100) timestamps, optionally in brackets;
+// if the key does not start with one, the first bracketed one counts. Times
+// without an offset are UTC, syslog times are in 1970. Keys without a
+// timestamp sort first.
+
+// With json, the key must be a JSON object and the value of its top-level
+// field json is compared: missing fields and null go first, then false, true,
+// numbers, which compare exactly by their decimal value, and strings. With an ordering like LSORT_KEY_NUMERIC, the value or
+// the contents of the string are compared that way.
+
+// LSORT_KEY_COLLATE stores the strxfrm() of the key, so comparisons stay
+// memcmp() of keys computed once per line. setlocale() must not be called
+// while a context with such a key exists.
+
+// With multiline, a line and the continuation lines after it are sorted as
+// one line; they are compared (and their keys extracted) as a whole, with the
+// delimiters between them. The first line of the data always starts a line.
+
+// With crlf, lines end with "\r\n": the '\r' is not compared, and a line that
+// ends the data without a delimiter gets "\r\n" when it is moved. With crlf
+// -1, this is the case for a buffer if its first line ends with "\r\n".
+
+// The first header lines stay where they are, the lines after them are sorted
+// as if they were all of the data. It does not apply to records.
+
+// With record_size, the data is an array of records of that size, which are
+// compared by the bytes at key_offset as an unsigned big-endian number (or by
+// compare, if set). Lines, keys and extract do not apply, and the engine is
+// always insertion; with fallback, the records are sorted in memory.
+
+// With framing, each record is a length prefix followed by that many bytes of
+// payload, and the key is at key_offset of the payload; it is shorter (or
+// empty) if the payload ends before. A record that is cut off by the end of
+// the data is an error. As records cannot be found backwards from the end of
+// one, their positions are indexed as they are scanned, but only as far back
+// as max_distance reaches; with max_distance 0, the index holds a pointer to
+// every record of the data, so its memory grows with the number of records.
+// With fallback, the records are sorted in memory and written back through a
+// temporary file.
+
+// a key like sort(1)'s -k; fields and characters are counted from 1,
+// end_field 0 means the end of the line and end_char 0 the end of end_field
+struct lsort_key
+{
+   size_t begin_field;
+   size_t begin_char;
+   size_t end_field;
+   size_t end_char;
+   unsigned flags;    // enum lsort_key_flags
+   const char* json;  // name of a JSON field, or NULL
+};
+
+struct lsort_options
+{
+   size_t max_compare;   // compare no more than N characters per line, 0 for no limit
+   size_t max_distance;  // maximum shift distance in bytes, 0 for no limit
+   int reverse;          // reverse the sort order, equal lines keep their order
+   int engine;           // enum lsort_engine
+   int fallback;         // use an external merge sort when max_distance is exceeded
+   size_t buffer_size;   // memory budget of the merge, block and external engines
+   int sync;             // enum lsort_sync, how changes to a mapped file are written
+   int immediate;        // disable deferred writes
+   int dry_run;          // map files privately, lsort_sort_fd() does not change them
+   int stats;            // measure the time spent in each phase
+   int perf;             // also read hardware performance counters, implies stats
+   FILE* log;            // where to report changes and engine choices, NULL for none
+   int fold;             // compare lines ignoring the case of ASCII letters, not keys
+   char delimiter;       // the byte that ends lines, '\n' by default
+   int multiline;        // lines which start with a blank belong to the line before
+   const char* record_start;  // or, if not NULL, lines which do not start with it
+   int crlf;             // lines end with "\r\n", -1 to detect it from the first line
+   size_t header;        // lines at the beginning which are not sorted
+   size_t record_size;   // sort binary records of this size instead of lines, 0 for lines
+   int framing;          // enum lsort_framing, sort length-prefixed records instead of lines
+   size_t key_offset;    // where the key of a record (or its payload) starts
+   size_t key_length;    // the size of the key of a record, 0 for the rest of the record
+   lsort_compare_t compare;  // NULL for byte-wise comparison
+   void* compare_arg;
+   lsort_extract_t extract;  // NULL to compare whole lines
+   void* extract_arg;
+   const struct lsort_key* keys;  // compare lines by these keys, used if extract is NULL
+   size_t key_count;
+   int separator;                 // field separator, -1 for runs of blanks
+};
+
+struct lsort_stats
+{
+   size_t size;
+   size_t lines;  // lines or records, each counted once
+   size_t comparisons;
+   size_t moved_back;
+   size_t moved_forward;
+   size_t bytes_moved;
+   size_t max_shift;
+   size_t msync_calls;
+   size_t msync_bytes;
+   size_t bufsize;
+   double time[ LSORT_PHASES ];
+   uint64_t counters[ LSORT_PHASES ][ LSORT_COUNTERS ];
+   unsigned counters_available;  // bit i is set if counter i could be opened
+   int counters_kernel;          // counters include the kernel
+};
+
+struct lsort_progress
+{
+   size_t size;
+   size_t bytes;
+   size_t lines;  // lines or records before bytes
+   size_t moves;
+   int phase;
+};
+
+struct lsort;
+
+void lsort_default_options( struct lsort_options* options );
+
+// parses sort(1)'s KEYDEF, F[.C][OPTS][,F[.C][OPTS]]; returns -1 if it is invalid
+int lsort_parse_key( const char* text, struct lsort_key* key );
+
+// whether flags select at most one of the orderings which exclude each other
+int lsort_key_flags_valid( unsigned flags );
+
+// returns NULL and sets errno on errors
+struct lsort* lsort_create( const struct lsort_options* options );
+void lsort_destroy( struct lsort* lsort );
+
+// sort the lines of a caller-provided buffer or of a mapped region in-place,
+// name is used in messages and may be NULL; return 0 on success, 1 if
+// cancelled and -1 on errors, see lsort_error()
+int lsort_sort_buffer( struct lsort* lsort, const char* name, char* data, size_t size );
+int lsort_sort_fd( struct lsort* lsort, const char* name, int fd );
+
+// async-signal-safe, stops a running sort at the next line; the context stays
+// cancelled and later sorts return 1 immediately
+void lsort_cancel( struct lsort* lsort );
+
+const char* lsort_error( const struct lsort* lsort );
+const struct lsort_stats* lsort_stats( const struct lsort* lsort );
+void lsort_progress( const struct lsort* lsort, struct lsort_progress* progress );
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,117 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+// Shared between liblsort and the lsort command, not installed.
+
+#ifndef LSORT_INTERNAL_H
+#define LSORT_INTERNAL_H
+
+#include <signal.h>
+#include <stdatomic.h>
+
+#include "lsort.h"
+
+#if defined( __GNUC__ ) && ( defined( __x86_64__ ) || ( defined( __i386__ ) && defined( __SSE2__ ) ) )
+#define LSORT_X86 1
+#include <immintrin.h>
+#elif defined( __aarch64__ ) && defined( __ARM_NEON )
+#define LSORT_NEON 1
+#include <arm_neon.h>
+#endif
+
+#ifdef __GNUC__
+#define ALWAYS_INLINE inline __attribute__( ( always_inline ) )
+#else
+#define ALWAYS_INLINE inline
+#endif
+
+struct line
+{
+   char* begin;
+   char* end;
+};
+
+// a growing buffer, used for sort keys
+struct arena
+{
+   char* data;
+   size_t size;
+   size_t capacity;
+};
+
+// a sort key stored in an arena
+struct key
+{
+   size_t offset;
+   size_t size;
+};
+
+struct lsort
+{
+   struct lsort_options options;
+   struct lsort_key* keys;
+   char* record_start;  // a copy of options.record_start
+   size_t record_start_size;
+   int crlf;            // options.crlf, or whether the data being sorted starts with a CRLF line
+   size_t header_lines;  // the lines skipped before the data being sorted, for line numbers
+   int msync_mode;
+   const char* name;
+   char error[ 256 ];
+
+   struct lsort_stats stats;
+   double phase_start;
+
+   int perf_group;
+   int perf_slot[ LSORT_COUNTERS ];
+   size_t perf_count;
+   uint64_t perf_last[ LSORT_COUNTERS ];
+
+   char* buffer;
+   size_t bufsize;
+
+   // cached keys of the lines before the current line of the insertion sort,
+   // window[ window_first + window_count - 1 ] belongs to the line just before it
+   struct key* window;
+   size_t window_first;
+   size_t window_count;
+   size_t window_capacity;
+   size_t window_bytes;
+   struct arena arena;
+   struct arena scratch[ 2 ];
+   struct arena collate[ 2 ];  // the text and the strxfrm() of a collated key
+   int failed;
+
+   // written by the sorting thread, read by lsort_cancel() and lsort_progress()
+   // from other threads or signal handlers
+   _Atomic int cancelled;
+   _Atomic int phase;
+   _Atomic size_t progress_size;  // stats.size, which is reset while it is read
+   _Atomic size_t progress_bytes;
+   _Atomic size_t progress_lines;
+   _Atomic size_t progress_moves;
+};
+
+double lsort_now( void );
+
+// the lsort_extract_t for options->keys, arg is the context
+size_t lsort_extract_keys( const char* line, size_t size, char* key, size_t capacity, void* arg );
+
+// lhs <= rhs, counts the comparison in the context
+int lsort_le( struct lsort* lsort, char* lhs_begin, char* lhs_end, char* rhs_begin, char* rhs_end );
+
+// the beginning of the line after the one containing pos, or end;
+// with multiline, continuation lines are part of the line before
+char* lsort_find( struct lsort* lsort, char* pos, char* end );
+
+// the beginning of the line before the one ending at prev, or data
+char* lsort_rfind( struct lsort* lsort, char* data, char* prev );
+
+// the beginning of the line after the first options.header lines of [data, end),
+// or end; sets lsort->header_lines to the number of lines skipped
+char* lsort_skip_header( struct lsort* lsort, char* data, char* end );
+
+// sets lsort->crlf from the options and, if they say so, the first line of the data
+void lsort_detect( struct lsort* lsort, const char* data, const char* end );
+
+#endif
@@ -0,0 +1,389 @@
+// Copyright (c) 2019-2021 Daniel Frey
+// Distributed under the Boost Software License, Version 1.0.
+// (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+// Tests liblsort through its public API: sorting buffers with each engine,
+// errors, compare and extract callbacks, cancelling a running sort from
+// another thread and independent contexts which sort concurrently in several
+// threads.
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "../lsort.h"
+
+// each line is an 8 digit key, a blank, a 6 digit payload and a newline
+#define LINE_SIZE 16
+#define LINES 20000
+#define THREADS 8
+
+int tests = 0;
+int failures = 0;
+
+void check( int ok, const char* what )
+{
+   ++tests;
+   if( !ok ) {
+      fprintf( stdout, "FAIL: %s\n", what );
+      ++failures;
+   }
+}
+
+uint64_t next_random( uint64_t* state )
+{
+   uint64_t z = ( *state += 0x9e3779b97f4a7c15ULL );
+   z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+   z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+   return z ^ ( z >> 31 );
+}
+
+// lines with unique keys, the first of each jitter lines is swapped with one
+// of them; with reverse, the keys are descending
+char* generate( size_t lines, size_t jitter, int reverse, uint64_t seed )
+{
+   char* data = (char*)malloc( lines * LINE_SIZE + 1 );
+   if( data == NULL ) {
+      fprintf( stderr, "Out of memory\n" );
+      exit( EXIT_FAILURE );
+   }
+   uint64_t state = seed;
+   for( size_t i = 0; i != lines; ++i ) {
+      snprintf( data + i * LINE_SIZE, LINE_SIZE + 1, "%08lu %06lu\n", (unsigned long)( reverse ? lines - i : i ), (unsigned long)( next_random( &state ) % 1000000 ) );
+   }
+   char line[ LINE_SIZE ];
+   for( size_t i = 0; ( jitter != 0 ) && ( i < lines ); i += jitter ) {
+      const size_t j = i + next_random( &state ) % jitter;
+      if( j < lines ) {
+         memcpy( line, data + i * LINE_SIZE, LINE_SIZE );
+         memcpy( data + i * LINE_SIZE, data + j * LINE_SIZE, LINE_SIZE );
+         memcpy( data + j * LINE_SIZE, line, LINE_SIZE );
+      }
+   }
+   return data;
+}
+
+int compare_lines( const void* lhs, const void* rhs )
+{
+   return memcmp( lhs, rhs, LINE_SIZE );
+}
+
+// whether data holds the lines of input in order, the keys are unique
+int is_sorted( const char* data, char* input, size_t lines, int reverse )
+{
+   qsort( input, lines, LINE_SIZE, compare_lines );
+   for( size_t i = 0; i != lines; ++i ) {
+      if( memcmp( data + i * LINE_SIZE, input + ( reverse ? lines - 1 - i : i ) * LINE_SIZE, LINE_SIZE ) != 0 ) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+void test_engines()
+{
+   const int engines[] = { LSORT_ENGINE_AUTO, LSORT_ENGINE_INSERTION, LSORT_ENGINE_MERGE, LSORT_ENGINE_BLOCK, LSORT_ENGINE_EXTERNAL };
+   for( size_t e = 0; e != sizeof( engines ) / sizeof( engines[ 0 ] ); ++e ) {
+      for( int reverse = 0; reverse != 2; ++reverse ) {
+         struct lsort_options options;
+         lsort_default_options( &options );
+         options.engine = engines[ e ];
+         options.reverse = reverse;
+         options.sync = LSORT_SYNC_NONE;
+         options.buffer_size = 64 << 10;
+         struct lsort* lsort = lsort_create( &options );
+         check( lsort != NULL, "lsort_create" );
+         if( lsort == NULL ) {
+            continue;
+         }
+         char* input = generate( LINES, 50, reverse, e );
+         char* data = generate( LINES, 50, reverse, e );
+         char what[ 64 ];
+         snprintf( what, sizeof( what ), "sort with engine %s%s", lsort_engine_names[ engines[ e ] ], reverse ? " and reverse" : "" );
+         check( ( lsort_sort_buffer( lsort, NULL, data, LINES * LINE_SIZE ) == 0 ) && is_sorted( data, input, LINES, reverse ), what );
+         const struct lsort_stats* stats = lsort_stats( lsort );
+         check( ( stats->size == LINES * LINE_SIZE ) && ( stats->lines == LINES ), "statistics of the sort" );
+         free( data );
+         free( input );
+         lsort_destroy( lsort );
+      }
+   }
+}
+
+void test_errors()
+{
+   struct lsort_options options;
+   lsort_default_options( &options );
+   options.engine = LSORT_ENGINE_INSERTION;
+   options.max_distance = 10 * LINE_SIZE;
+   options.sync = LSORT_SYNC_NONE;
+   struct lsort* lsort = lsort_create( &options );
+   check( lsort != NULL, "lsort_create" );
+   if( lsort == NULL ) {
+      return;
+   }
+   char* data = generate( LINES, 100, 0, 1 );
+   check( ( lsort_sort_buffer( lsort, "data", data, LINES * LINE_SIZE ) == -1 ) && ( strstr( lsort_error( lsort ), "data:" ) == lsort_error( lsort ) ), "exceeding the distance is an error" );
+   free( data );
+
+   // the context can be used again after an error
+   char* input = generate( LINES, 10, 0, 2 );
+   data = generate( LINES, 10, 0, 2 );
+   check( ( lsort_sort_buffer( lsort, NULL, data, LINES * LINE_SIZE ) == 0 ) && is_sorted( data, input, LINES, 0 ), "sort after an error" );
+   free( data );
+   free( input );
+   lsort_destroy( lsort );
+}
+
+// the callbacks count their calls in their argument
+struct calls
+{
+   size_t compare;
+   size_t extract;
+   size_t retries;  // calls with too little room for the key
+   size_t refused;  // calls after a retry with still too little room
+   size_t required;
+};
+
+int compare_descending( const char* lhs, size_t lhs_size, const char* rhs, size_t rhs_size, void* arg )
+{
+   ++( (struct calls*)arg )->compare;
+   const int result = memcmp( lhs, rhs, ( lhs_size < rhs_size ) ? lhs_size : rhs_size );
+   return ( result != 0 ) ? -result : ( rhs_size > lhs_size ) - ( rhs_size < lhs_size );
+}
+
+// the key of a line is its 8 digit key repeated 13 times, which is larger
+// than the line and does not divide the size of the arenas, so it often does
+// not fit the room that is left
+#define KEY_REPEAT 13
+
+size_t extract_repeated( const char* line, size_t size, char* key, size_t capacity, void* arg )
+{
+   struct calls* calls = (struct calls*)arg;
+   ++calls->extract;
+   const size_t required = ( size < 8 ) ? size : 8 * KEY_REPEAT;
+   if( ( calls->required != 0 ) && ( capacity < calls->required ) ) {
+      ++calls->refused;
+   }
+   calls->required = 0;
+   if( capacity < required ) {
+      ++calls->retries;
+      calls->required = required;
+      return required;
+   }
+   for( size_t i = 0; i != required; i += 8 ) {
+      memcpy( key + i, line, ( size < 8 ) ? size : 8 );
+   }
+   return required;
+}
+
+void test_callbacks()
+{
+   struct calls calls;
+   memset( &calls, 0, sizeof( calls ) );
+   struct lsort_options options;
+   lsort_default_options( &options );
+   options.engine = LSORT_ENGINE_INSERTION;
+   options.sync = LSORT_SYNC_NONE;
+   options.compare = compare_descending;
+   options.compare_arg = &calls;
+   struct lsort* lsort = lsort_create( &options );
+   check( lsort != NULL, "lsort_create" );
+   if( lsort != NULL ) {
+      char* input = generate( LINES, 20, 1, 5 );
+      char* data = generate( LINES, 20, 1, 5 );
+      check( ( lsort_sort_buffer( lsort, NULL, data, LINES * LINE_SIZE ) == 0 ) && is_sorted( data, input, LINES, 1 ) && ( calls.compare != 0 ), "sort with a compare callback" );
+      free( data );
+      free( input );
+      lsort_destroy( lsort );
+   }
+
+   const int engines[] = { LSORT_ENGINE_INSERTION, LSORT_ENGINE_MERGE, LSORT_ENGINE_BLOCK, LSORT_ENGINE_EXTERNAL };
+   for( size_t e = 0; e != sizeof( engines ) / sizeof( engines[ 0 ] ); ++e ) {
+      memset( &calls, 0, sizeof( calls ) );
+      lsort_default_options( &options );
+      options.engine = engines[ e ];
+      options.sync = LSORT_SYNC_NONE;
+      options.buffer_size = 64 << 10;
+      options.extract = extract_repeated;
+      options.extract_arg = &calls;
+      lsort = lsort_create( &options );
+      check( lsort != NULL, "lsort_create" );
+      if( lsort == NULL ) {
+         continue;
+      }
+      char* input = generate( LINES, 20, 0, 6 + e );
+      char* data = generate( LINES, 20, 0, 6 + e );
+      char what[ 64 ];
+      snprintf( what, sizeof( what ), "extract keys larger than the room with engine %s", lsort_engine_names[ engines[ e ] ] );
+      check( ( lsort_sort_buffer( lsort, NULL, data, LINES * LINE_SIZE ) == 0 ) && is_sorted( data, input, LINES, 0 ) && ( calls.retries != 0 ) && ( calls.refused == 0 ), what );
+      free( data );
+      free( input );
+      lsort_destroy( lsort );
+   }
+}
+
+// the insertion engine caches the keys of the last 65536 lines, lines which
+// move further are compared with keys that are extracted again
+void test_key_window()
+{
+   const size_t lines = 65536 + 10000;
+   struct calls calls;
+   struct lsort_options options;
+   lsort_default_options( &options );
+   options.engine = LSORT_ENGINE_INSERTION;
+   options.sync = LSORT_SYNC_NONE;
+   options.extract = extract_repeated;
+   options.extract_arg = &calls;
+   struct lsort* lsort = lsort_create( &options );
+   check( lsort != NULL, "lsort_create" );
+   if( lsort == NULL ) {
+      return;
+   }
+   for( int forward = 0; forward != 2; ++forward ) {
+      memset( &calls, 0, sizeof( calls ) );
+      char* input = generate( lines, 0, 0, 7 );
+      char* data = generate( lines, 0, 0, 7 );
+      char line[ LINE_SIZE ];
+      if( !forward ) {
+         // the first line is last, it moves back past all others
+         memcpy( line, data, LINE_SIZE );
+         memmove( data, data + LINE_SIZE, ( lines - 1 ) * LINE_SIZE );
+         memcpy( data + ( lines - 1 ) * LINE_SIZE, line, LINE_SIZE );
+      }
+      else {
+         // the last line is first, it moves forward past all others
+         memcpy( line, data + ( lines - 1 ) * LINE_SIZE, LINE_SIZE );
+         memmove( data + LINE_SIZE, data, ( lines - 1 ) * LINE_SIZE );
+         memcpy( data, line, LINE_SIZE );
+      }
+      const int result = lsort_sort_buffer( lsort, NULL, data, lines * LINE_SIZE );
+      const struct lsort_stats* stats = lsort_stats( lsort );
+      check( ( result == 0 ) && is_sorted( data, input, lines, 0 ) && ( calls.extract - calls.retries > lines ) && ( stats->max_shift == lines * LINE_SIZE ), forward ? "move a line forward past the key window" : "move a line back past the key window" );
+      free( data );
+      free( input );
+   }
+   lsort_destroy( lsort );
+}
+
+struct job
+{
+   struct lsort* lsort;
+   char* data;
+   size_t size;
+   int result;
+};
+
+void* sort_job( void* arg )
+{
+   struct job* job = (struct job*)arg;
+   job->result = lsort_sort_buffer( job->lsort, NULL, job->data, job->size );
+   return NULL;
+}
+
+void test_cancel()
+{
+   struct lsort_options options;
+   lsort_default_options( &options );
+   options.engine = LSORT_ENGINE_INSERTION;
+   options.sync = LSORT_SYNC_NONE;
+   struct lsort* lsort = lsort_create( &options );
+   check( lsort != NULL, "lsort_create" );
+   if( lsort == NULL ) {
+      return;
+   }
+
+   // descending lines take the insertion engine quadratic time
+   const size_t lines = 50000;
+   struct job job = { lsort, generate( lines, 0, 1, 3 ), lines * LINE_SIZE, -1 };
+   pthread_t thread;
+   if( pthread_create( &thread, NULL, sort_job, &job ) != 0 ) {
+      check( 0, "pthread_create" );
+      free( job.data );
+      lsort_destroy( lsort );
+      return;
+   }
+   struct lsort_progress progress;
+   const struct timespec delay = { 0, 1000000 };
+   do {
+      nanosleep( &delay, NULL );
+      lsort_progress( lsort, &progress );
+   } while( progress.moves < 100 );
+   lsort_cancel( lsort );
+   pthread_join( thread, NULL );
+   check( ( job.result == 1 ) && ( progress.size == job.size ) && ( progress.bytes < job.size ) && ( progress.phase < LSORT_PHASES ), "cancel a running sort" );
+
+   // the context stays cancelled
+   char* data = generate( 100, 10, 0, 4 );
+   char* input = generate( 100, 10, 0, 4 );
+   check( ( lsort_sort_buffer( lsort, NULL, data, 100 * LINE_SIZE ) == 1 ) && ( memcmp( data, input, 100 * LINE_SIZE ) == 0 ), "sort after cancel" );
+   free( input );
+   free( data );
+   free( job.data );
+   lsort_destroy( lsort );
+}
+
+struct worker
+{
+   int index;
+   int ok;
+};
+
+void* work( void* arg )
+{
+   struct worker* worker = (struct worker*)arg;
+   struct lsort_options options;
+   lsort_default_options( &options );
+   options.engine = 1 + worker->index % 4;
+   options.reverse = worker->index & 1;
+   options.sync = LSORT_SYNC_NONE;
+   options.buffer_size = 64 << 10;
+   struct lsort* lsort = lsort_create( &options );
+   worker->ok = ( lsort != NULL );
+   for( int i = 0; worker->ok && ( i != 4 ); ++i ) {
+      const uint64_t seed = worker->index * 16 + i;
+      char* input = generate( LINES, 20, options.reverse, seed );
+      char* data = generate( LINES, 20, options.reverse, seed );
+      worker->ok = ( lsort_sort_buffer( lsort, NULL, data, LINES * LINE_SIZE ) == 0 ) && is_sorted( data, input, LINES, options.reverse ) && ( lsort_stats( lsort )->lines == LINES );
+      free( data );
+      free( input );
+   }
+   lsort_destroy( lsort );
+   return NULL;
+}
+
+void test_threads()
+{
+   pthread_t threads[ THREADS ];
+   struct worker workers[ THREADS ];
+   int started = 0;
+   for( ; started != THREADS; ++started ) {
+      workers[ started ].index = started;
+      workers[ started ].ok = 0;
+      if( pthread_create( &threads[ started ], NULL, work, &workers[ started ] ) != 0 ) {
+         break;
+      }
+   }
+   check( started == THREADS, "pthread_create" );
+   for( int i = 0; i != started; ++i ) {
+      pthread_join( threads[ i ], NULL );
+      char what[ 64 ];
+      snprintf( what, sizeof( what ), "sort in thread %d", i );
+      check( workers[ i ].ok, what );
+   }
+}
+
+int main()
+{
+   test_engines();
+   test_errors();
+   test_callbacks();
+   test_key_window();
+   test_cancel();
+   test_threads();
+   fprintf( stdout, "%d API tests, %d failures\n", tests, failures );
+   return ( failures == 0 ) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
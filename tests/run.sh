@@ -0,0 +1,368 @@
+#!/bin/sh
+# Copyright (c) 2019-2021 Daniel Frey
+# Distributed under the Boost Software License, Version 1.0.
+# (See accompanying file LICENSE_1_0.txt or copy at https://www.boost.org/LICENSE_1_0.txt)
+
+# Sorts small inputs with each engine and mode of lsort and compares the
+# results with LC_ALL=C sort -s or with the expected output. Inputs and
+# expected outputs are given like printf's %b arguments, \0NNN is a byte
+# in octal.
+#
+#   LSORT   the binary to use
+#   TMPDIR  where the inputs are written
+
+dir=$(dirname "$0")
+LSORT=${LSORT:-$dir/../lsort}
+ENGINES="insertion merge block external auto"
+
+work=$(mktemp -d "${TMPDIR:-/tmp}/lsort-check.XXXXXX") || exit 1
+trap 'rm -rf "$work"' EXIT INT TERM
+
+tests=0
+failures=0
+
+fail()
+{
+   printf 'FAIL: %s\n' "$*"
+   failures=$(( failures + 1 ))
+}
+
+# input TEXT
+input()
+{
+   printf '%b' "$1" > "$work/input"
+}
+
+# generate MODEL: 2000 lines with unique keys, which are sorted, jittered by
+# up to 20 lines, have every 100th line 500 lines late or are reversed
+generate()
+{
+   awk -v model="$1" 'BEGIN {
+      srand( 1 );
+      n = 2000;
+      for( i = 0; i < n; ++i ) {
+         key[ i ] = ( model == "reverse" ) ? n - i : i;
+      }
+      for( i = 0; i < n; ++i ) {
+         j = -1;
+         if( model == "jitter" ) {
+            j = i + int( rand() * 20 );
+         }
+         else if( ( model == "late" ) && ( i >= 500 ) && ( i % 100 == 0 ) ) {
+            j = i - 500;
+         }
+         if( ( j >= 0 ) && ( j < n ) ) {
+            t = key[ i ];
+            key[ i ] = key[ j ];
+            key[ j ] = t;
+         }
+      }
+      for( i = 0; i < n; ++i ) {
+         line = sprintf( "%08d ", key[ i ] );
+         for( k = int( rand() * 100 ); k >= 0; --k ) {
+            line = line substr( "abcdefghijklmnopqrstuvwxyz", 1 + int( rand() * 26 ), 1 );
+         }
+         print line;
+      }
+   }' > "$work/input"
+}
+
+# run OPTION...: sorts a copy of the input, sets rc
+run()
+{
+   tests=$(( tests + 1 ))
+   cp "$work/input" "$work/data"
+   "$LSORT" -q "$@" "$work/data" > "$work/out" 2>&1
+   rc=$?
+}
+
+# sorts SORT_OPTIONS OPTION...: the result must be the same as sort(1)'s
+sorts()
+{
+   sort_options=$1
+   shift
+   run "$@"
+   LC_ALL=C sort -s $sort_options < "$work/input" > "$work/expected"
+   if [ $rc -ne 0 ] || ! cmp -s "$work/data" "$work/expected"; then
+      fail "lsort $* (sort -s $sort_options), exit code $rc"
+   fi
+}
+
+# expect TEXT OPTION...: the result must be TEXT
+expect()
+{
+   printf '%b' "$1" > "$work/expected"
+   shift
+   run "$@"
+   if [ $rc -ne 0 ] || ! cmp -s "$work/data" "$work/expected"; then
+      fail "lsort $*, exit code $rc"
+   fi
+}
+
+# fails OPTION...: lsort must report an error, not crash
+fails()
+{
+   run "$@"
+   if [ $rc -ne 1 ]; then
+      fail "lsort $* should fail, exit code $rc"
+   fi
+}
+
+# checks CODE OPTION...: lsort --check must exit with CODE
+checks()
+{
+   code=$1
+   shift
+   tests=$(( tests + 1 ))
+   "$LSORT" -C "$@" "$work/input" > "$work/out" 2>&1
+   rc=$?
+   if [ $rc -ne "$code" ]; then
+      fail "lsort -C $* should exit with $code, exit code $rc"
+   fi
+}
+
+# last NAME: the last number named NAME in the output, like the totals of
+# --stats=json or the final progress record
+last()
+{
+   grep -o "\"$1\":[0-9]*" "$work/out" | tail -n 1 | cut -d : -f 2
+}
+
+# lines which are too far from their place, with and without --fallback
+for model in sorted jitter late reverse; do
+   generate "$model"
+   sorts "" -d 0
+   sorts -r -r -d 0
+   sorts "" -d 4K --fallback -S 16K
+done
+generate late
+fails -d 4K
+sorts "" -d 1K --fallback -S 4K
+
+# each engine
+for model in sorted jitter late reverse; do
+   generate "$model"
+   for engine in $ENGINES; do
+      sorts "" --engine "$engine" -S 16K
+      sorts -r -r --engine "$engine" -S 16K
+   done
+done
+
+# check
+input 'a\nb\nb\nc'
+checks 0
+checks 1 -r
+input 'h\na\nc\nb\nd\nc\n'
+checks 1
+checks 1 --check=all
+if [ "$( wc -l < "$work/out" )" -ne 3 ]; then
+   fail "lsort --check=all should report 3 disorders"
+fi
+
+# analyze
+input 'h\na\nc\nb\nd\nc\n'
+tests=$(( tests + 1 ))
+if ! "$LSORT" --analyze "$work/input" > "$work/out" 2>&1 || ! grep -q ': 6 lines, 12 bytes$' "$work/out"; then
+   fail "lsort --analyze"
+fi
+
+# keys, lines with equal keys keep their order
+keyed='b 2\na 10\nc 1\na 2\nB 3\n\n  d 0x1F\nb 1.5K\na 1e1\nc -3\nb 1G\nA 2\na v1.10\na v1.9\n'
+input "$keyed"
+for engine in $ENGINES; do
+   for options in "" -r -b -k2 -k2,2 "-k1,1 -r" "-t . -k2"; do
+      sorts "$options" --engine "$engine" -S 64 $options
+   done
+done
+
+# with -r, equal lines are not moved past each other
+input 'b\na\na\n'
+for engine in insertion merge; do
+   expect 'b\na\na\n' --engine "$engine" -r -v
+   if [ -s "$work/out" ]; then
+      fail "lsort --engine $engine -r -v should not move equal lines"
+   fi
+done
+
+# late lines which are equal to kept lines go after them
+input '1 a\n3 b\n1 c\n3 d\n1 e\n2 f\n1 g\n'
+for engine in $ENGINES; do
+   sorts -k1,1 --engine "$engine" -k1,1
+   sorts "-k1,1 -r" --engine "$engine" -k1,1 -r
+done
+
+# numeric keys
+input "$keyed"
+for engine in $ENGINES; do
+   for options in -n -g -k2,2n -k2,2g; do
+      sorts "$options" --engine "$engine" -S 64 $options
+   done
+done
+
+# timestamps
+input '2021-03-04T05:06:07Z b\n2021-03-04T05:06:06+01:00 a\nnone\nMar  4 05:06:07 c\n[04/Mar/2021:05:06:07 +0100] d\n'
+expect 'none\nMar  4 05:06:07 c\n2021-03-04T05:06:06+01:00 a\n[04/Mar/2021:05:06:07 +0100] d\n2021-03-04T05:06:07Z b\n' --time-sort
+
+# JSON keys
+input '{"t":3}\n{"t":"a"}\n{"t":1,"u":2}\n{"x":1}\n{"t":null}\n{"t":true}\n'
+expect '{"x":1}\n{"t":null}\n{"t":true}\n{"t":1,"u":2}\n{"t":3}\n{"t":"a"}\n' --json-key t
+# numbers compare exactly, also beyond the precision of a double
+input '{"t":1700000000000000001}\n{"t":1e2}\n{"t":1700000000000000000}\n{"t":-2.5E-1}\n{"t":99.50}\n{"t":0.0}\n{"t":100}\n'
+expect '{"t":-2.5E-1}\n{"t":0.0}\n{"t":99.50}\n{"t":1e2}\n{"t":100}\n{"t":1700000000000000000}\n{"t":1700000000000000001}\n' --json-key t
+input '{"seq":9007199254740993}\n{"seq":9007199254740992}\n'
+checks 1 --json-key seq
+
+# folded case
+input "$keyed"
+for engine in $ENGINES; do
+   for options in -f "-k1,1f -k2,2nr"; do
+      sorts "$options" --engine "$engine" -S 64 $options
+   done
+done
+
+# collation, if one of these locales is installed; long lines grow the buffers
+# of the keys
+locale=$(locale -a 2>/dev/null | grep -x -m 1 -e en_US.utf8 -e en_US.UTF-8 -e de_DE.utf8 -e de_DE.UTF-8 -e C.utf8 -e C.UTF-8)
+if [ -n "$locale" ]; then
+   long=$(awk 'BEGIN { for( i = 0; i < 1000; ++i ) { printf "x" } }')
+   input "${keyed}Ab\nab\n\303\244b\n_a 2\na $long 2\nA $long 1\n"
+   for engine in $ENGINES; do
+      for options in --collate "--collate -r" "-k1,1c -k2,2n"; do
+         tests=$(( tests + 1 ))
+         cp "$work/input" "$work/data"
+         LC_ALL=$locale "$LSORT" -q --engine "$engine" -S 64 $options "$work/data" > "$work/out" 2>&1
+         rc=$?
+         sort_options=$(printf '%s' "$options" | sed -e 's/--collate//' -e 's/c / /')
+         LC_ALL=$locale sort -s $sort_options < "$work/input" > "$work/expected"
+         if [ $rc -ne 0 ] || ! cmp -s "$work/data" "$work/expected"; then
+            fail "LC_ALL=$locale lsort --engine $engine $options (sort -s $sort_options), exit code $rc"
+         fi
+      done
+   done
+else
+   printf 'skipping the collation tests, no locale found\n'
+fi
+
+# version and human-numeric keys
+input "$keyed"
+for engine in $ENGINES; do
+   for options in -h -V -k2,2h -k2,2V; do
+      sorts "$options" --engine "$engine" -S 64 $options
+   done
+done
+
+# other delimiters
+input 'b\0000a\0000c\0000a\0000'
+for engine in $ENGINES; do
+   sorts -z -z --engine "$engine" -S 4
+done
+
+# records
+input 'dddd\0000\0001\0002\0003cccc\0000\0000\0000\0000'
+expect '\0000\0000\0000\0000\0000\0001\0002\0003ccccdddd' --record-size 4
+expect 'ddddcccc\0000\0001\0002\0003\0000\0000\0000\0000' --record-size 4 -r
+expect '\0000\0000\0000\0000\0000\0001\0002\0003ccccdddd' --record-size 4 --key-offset 2 --key-length 1
+expect '\0000\0000\0000\0000\0000\0001\0002\0003ccccdddd' --record-size 4 -d 4 --fallback
+for distance in 1 3 4 7; do
+   fails --record-size 4 -d $distance
+   expect '\0000\0000\0000\0000\0000\0001\0002\0003ccccdddd' --record-size 4 -d $distance --fallback
+done
+fails --record-size 3
+
+# framed records
+input '\0001c\0002bb\0000\0001a'
+expect '\0000\0001a\0002bb\0001c' --framing varint
+input '\0001\0000\0000\0000c\0002\0000\0000\0000bb\0000\0000\0000\0000\0001\0000\0000\0000a'
+expect '\0000\0000\0000\0000\0001\0000\0000\0000a\0002\0000\0000\0000bb\0001\0000\0000\0000c' --framing le32
+expect '\0001\0000\0000\0000c\0000\0000\0000\0000\0001\0000\0000\0000a\0002\0000\0000\0000bb' --framing le32 --key-offset 1
+for distance in 1 4 5; do
+   fails --framing le32 -d $distance
+   expect '\0000\0000\0000\0000\0001\0000\0000\0000a\0002\0000\0000\0000bb\0001\0000\0000\0000c' --framing le32 -d $distance --fallback
+done
+input '\0000\0000\0000\0001c\0000\0000\0000\0002bb\0000\0000\0000\0001a'
+expect '\0000\0000\0000\0001a\0000\0000\0000\0002bb\0000\0000\0000\0001c' --framing be32
+input '\0000\0000\0000\0011c'
+fails --framing be32
+# the 46 byte records drop the first ones from the index of records in reach,
+# the last record goes before all that are left and must not be put after them
+z=zzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzzz
+input '\0002\0000\0000\0000xy\0000\0000\0000\0000\0002\0000\0000\0000xy\0003\0000\0000\0000xy\0000\0056\0000\0000\0000xy\0001\0002\0000\0000'$z'\0056\0000\0000\0000xy\0377\0002\0000\0002'$z'\0003\0000\0000\0000xy\0002\0003\0000\0000\0000xy\0002\0005\0000\0000\0000xy\0002\0377\0200\0003\0000\0000\0000xy\0200\0001\0000\0000\0000x'
+fails --framing le32 --key-offset 2 --key-length 4 -d 100
+expect '\0002\0000\0000\0000xy\0000\0000\0000\0000\0002\0000\0000\0000xy\0001\0000\0000\0000x\0003\0000\0000\0000xy\0000\0056\0000\0000\0000xy\0001\0002\0000\0000'$z'\0003\0000\0000\0000xy\0002\0003\0000\0000\0000xy\0002\0005\0000\0000\0000xy\0002\0377\0200\0003\0000\0000\0000xy\0200\0056\0000\0000\0000xy\0377\0002\0000\0002'$z --framing le32 --key-offset 2 --key-length 4 -d 100 --fallback
+
+# multi-line records
+for engine in $ENGINES; do
+   input 'b\n  b2\na\n\ta2\n'
+   expect 'a\n\ta2\nb\n  b2\n' --engine "$engine" -S 8 --multiline
+   input '>b\nx\n>a\ny'
+   expect '>a\ny\n>b\nx' --engine "$engine" -S 8 --record-start '>'
+done
+
+# CRLF lines
+for engine in $ENGINES; do
+   input 'c\r\na\t\r\nb\r\na'
+   expect 'a\r\na\t\r\nb\r\nc' --engine "$engine" -S 8 --crlf
+   expect 'a\r\na\t\r\nb\r\nc' --engine "$engine" -S 8 --crlf=auto
+   input 'a\t\r\na\r\n'
+   expect 'a\t\r\na\r\n' --engine "$engine" -S 8
+done
+
+# header lines
+for engine in $ENGINES; do
+   input 'z\ny\nb\na\nc'
+   expect 'z\ny\na\nb\nc' --engine "$engine" -S 8 --header 2
+   expect 'z\ny\nb\na\nc' --engine "$engine" -S 8 --header 5
+done
+input 'h\na\nc\nb\nd\nc\n'
+checks 0 --header 5
+
+# statistics, the totals are those of all files
+generate jitter
+cp "$work/input" "$work/second"
+size=$(( $( wc -c < "$work/input" ) * 2 ))
+lines=$(( $( wc -l < "$work/input" ) * 2 ))
+for engine in $ENGINES; do
+   run --engine "$engine" -S 16K --stats=json "$work/second"
+   if [ "$( last size )" != $size ] || [ "$( last lines )" != $lines ]; then
+      fail "lsort --engine $engine --stats=json should count $size bytes and $lines lines"
+   fi
+   run --engine "$engine" -S 16K --stats "$work/second"
+   if ! grep -q "^total: $size bytes, $lines lines, " "$work/out"; then
+      fail "lsort --engine $engine --stats should count $size bytes and $lines lines"
+   fi
+done
+
+# progress records, the final one counts all lines and bytes
+generate jitter
+size=$(( $( wc -c < "$work/input" ) ))
+lines=$(( $( wc -l < "$work/input" ) ))
+number='[0-9]+(\.[0-9]+)?'
+record="^\\{\"file\":\".*\",\"phase\":\"[a-z]+\",\"bytes\":[0-9]+,\"size\":$size,\"lines\":[0-9]+,\"moves\":[0-9]+,\"elapsed\":$number,\"mb_per_s\":$number,\"eta\":($number|null),\"done\":(true|false)\\}\$"
+for engine in $ENGINES; do
+   tests=$(( tests + 1 ))
+   cp "$work/input" "$work/data"
+   "$LSORT" -q --engine "$engine" -S 16K --progress-fd 3 "$work/data" 3> "$work/out"
+   if grep -Eqv "$record" "$work/out" || ! tail -n 1 "$work/out" | grep -Eq "\"bytes\":$size,\"size\":$size,\"lines\":$lines,.*\"eta\":0,\"done\":true\\}\$"; then
+      fail "lsort --engine $engine --progress-fd 3 should end with $size bytes and $lines lines done"
+   fi
+done
+
+# performance counters, which may be unavailable
+input 'b\na\nc\n'
+run --perf
+value='([0-9]+|n/a)'
+for phase in scan search move sync sort; do
+   if ! grep -Eq "^total: $phase, cycles $value, instructions $value, llc_misses $value, dtlb_misses $value, page_faults $value\$" "$work/out"; then
+      fail "lsort --perf should report the counters of $phase"
+   fi
+done
+run --perf --stats=json
+value='([0-9]+|null)'
+for phase in scan search move sync sort; do
+   if ! grep -Eq "\"total\":.*\"perf\":\\{\"kernel\":(true|false),.*\"$phase\":\\{\"cycles\":$value,\"instructions\":$value,\"llc_misses\":$value,\"dtlb_misses\":$value,\"page_faults\":$value\\}" "$work/out"; then
+      fail "lsort --perf --stats=json should report the counters of $phase"
+   fi
+done
+
+printf '%d tests, %d failures\n' "$tests" "$failures"
+[ $failures -eq 0 ]